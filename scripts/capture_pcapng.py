@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+#
+# capture_pcapng.py: Convert superbitrf capture records to pcapng
+# Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# The input is the raw output of the dongle with capture_enable set and
+# capture_format at CAPTURE_FORMAT_RECORD (src/modules/capture.h), read from a
+# file or directly from the serial port. Every captured packet is written as a
+# pcapng enhanced packet block with LINKTYPE_USER0, the link-layer header is
+# struct CapturePacket. Open the result in Wireshark with scripts/dsm.lua.
+
+from __future__ import print_function
+
+import struct
+import sys
+
+from optparse import OptionParser
+
+CAPTURE_SYNC = 0xA5
+CAPTURE_TYPE_PACKET = 0
+CAPTURE_TYPE_STATS = 1
+CAPTURE_TYPE_LINKSTATS = 2
+CAPTURE_TYPE_TELEMETRY = 3
+CAPTURE_PACKET_HEADER = 9
+CAPTURE_MAX_DATA = 16
+CAPTURE_STATS_SIZE = 20
+CAPTURE_LINKSTATS_SIZE = 40
+LINKTYPE_USER0 = 147
+
+def pcapng_header():
+	shb = struct.pack("<IIIHHqI", 0x0A0D0D0A, 28, 0x1A2B3C4D, 1, 0, -1, 28)
+	idb = struct.pack("<IIHHII", 0x00000001, 20, LINKTYPE_USER0, 0, 0, 20)
+	return shb + idb
+
+def pcapng_packet(timestamp, data):
+	padded = data + b"\0" * (-len(data) % 4)
+	total = 32 + len(padded)
+	return struct.pack("<IIIIIII", 0x00000006, total, 0, timestamp >> 32,
+			timestamp & 0xFFFFFFFF, len(data), len(data)) + padded + struct.pack("<I", total)
+
+def records(stream):
+	"""Yield (type, record) and resynchronize on the sync byte after garbage"""
+	buf = b""
+	skipped = 0
+	while True:
+		chunk = stream.read(4096)
+		if not chunk:
+			break
+		buf += chunk
+		while len(buf) >= 3:
+			if ord(buf[0:1]) != CAPTURE_SYNC:
+				buf = buf[1:]
+				skipped += 1
+				continue
+
+			rtype, length = ord(buf[1:2]), ord(buf[2:3])
+			if (rtype == CAPTURE_TYPE_PACKET and CAPTURE_PACKET_HEADER < length <= CAPTURE_PACKET_HEADER + CAPTURE_MAX_DATA) \
+					or (rtype == CAPTURE_TYPE_STATS and length == CAPTURE_STATS_SIZE) \
+					or (rtype == CAPTURE_TYPE_LINKSTATS and length == CAPTURE_LINKSTATS_SIZE) \
+					or (rtype == CAPTURE_TYPE_TELEMETRY and 0 < length <= CAPTURE_MAX_DATA - 2):
+				if len(buf) < 3 + length:
+					break
+				yield rtype, buf[3:3 + length]
+				buf = buf[3 + length:]
+			else:
+				buf = buf[1:]
+				skipped += 1
+	if skipped:
+		print("Skipped %d bytes of non-capture data" % skipped, file=sys.stderr)
+
+def main():
+	parser = OptionParser(usage="%prog [options] INPUT OUTPUT.pcapng")
+	parser.add_option("-s", "--stats", action="store_true", dest="stats",
+			help="Print the capture statistics records")
+	parser.add_option("-l", "--linkstats", action="store_true", dest="linkstats",
+			help="Print the link statistics records of every hop")
+	parser.add_option("-t", "--telemetry", action="store_true", dest="telemetry",
+			help="Print the telemetry received by the transmitter")
+	(options, args) = parser.parse_args()
+	if len(args) != 2:
+		parser.error("Need an input and an output file")
+
+	count = 0
+	high = 0
+	last = 0
+	with open(args[0], "rb") as stream, open(args[1], "wb") as out:
+		out.write(pcapng_header())
+		for rtype, record in records(stream):
+			if rtype == CAPTURE_TYPE_STATS:
+				if options.stats:
+					(timestamp, captured, dropped, usb_packets, capture_rate, usb_rate) = struct.unpack("<IIIIHH", record)
+					print("%10.3f s: %u captured, %u dropped, %u packets/s, %u USB packets/s" %
+							(timestamp / 1e6, captured, dropped, capture_rate, usb_rate))
+				continue
+			if rtype == CAPTURE_TYPE_LINKSTATS:
+				if options.linkstats:
+					fields = struct.unpack("<BBHHH8H8H", record)
+					(hop, channel, received, bad_crc, timeouts) = fields[0:5]
+					print("hop %2u channel 0x%02X: %5u received, %5u bad CRC, %5u timeouts, RSSI %s, jitter %s" %
+							(hop, channel, received, bad_crc, timeouts,
+							" ".join("%u" % v for v in fields[5:13]), " ".join("%u" % v for v in fields[13:21])))
+				continue
+			if rtype == CAPTURE_TYPE_TELEMETRY:
+				if options.telemetry:
+					print("telemetry: %s" % " ".join("%02X" % ord(record[i:i + 1]) for i in range(len(record))))
+				continue
+
+			# Extend the 32 bit microsecond timestamp
+			timestamp = struct.unpack("<I", record[0:4])[0]
+			if timestamp < last:
+				high += 1 << 32
+			last = timestamp
+
+			out.write(pcapng_packet(high + timestamp, record))
+			count += 1
+
+	print("Converted %d packets" % count, file=sys.stderr)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,160 @@
+-- dsm.lua: Wireshark dissector for superbitrf DSM2/DSMX captures
+-- Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+--
+-- This program is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- This program is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with this program.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Usage: wireshark -X lua_script:scripts/dsm.lua capture.pcapng
+--
+-- The link-layer header is struct CapturePacket from src/modules/capture.h,
+-- the payload is one of the packets build by the firmware:
+--  - bind packet (dsm_transmitter_create_bind_packet)
+--  - command packet (dsm_transmitter_create_command_packet)
+--  - data packet (dsm_mitm_create_packet)
+
+local dsm = Proto("superbitrf", "superbitrf DSM capture")
+
+local CAPTURE_FLAG_ERROR = 0x01
+local CAPTURE_FLAG_CRC_INVERTED = 0x02
+local CAPTURE_FLAG_TELEMETRY = 0x04
+
+-- The header of the command packets, learned from the first one
+local command_header = nil
+
+local f = dsm.fields
+f.timestamp = ProtoField.uint32("superbitrf.timestamp", "Timestamp (us)", base.DEC)
+f.channel = ProtoField.uint8("superbitrf.channel", "RF channel", base.DEC)
+f.sop_col = ProtoField.uint8("superbitrf.sop_col", "SOP column", base.DEC)
+f.flags = ProtoField.uint8("superbitrf.flags", "Flags", base.HEX)
+f.flag_error = ProtoField.bool("superbitrf.flags.error", "Receive error", 8, nil, CAPTURE_FLAG_ERROR)
+f.flag_crc = ProtoField.bool("superbitrf.flags.crc_inverted", "Inverted CRC seed", 8, nil, CAPTURE_FLAG_CRC_INVERTED)
+f.flag_telemetry = ProtoField.bool("superbitrf.flags.telemetry", "Telemetry data", 8, nil, CAPTURE_FLAG_TELEMETRY)
+f.rssi = ProtoField.uint8("superbitrf.rssi", "RSSI", base.DEC, nil, 0x1F)
+f.rssi_sop = ProtoField.bool("superbitrf.rssi.sop", "RSSI sampled at SOP", 8, nil, 0x80)
+f.rx_status = ProtoField.uint8("superbitrf.rx_status", "RX status", base.HEX)
+f.rx_bad_crc = ProtoField.bool("superbitrf.rx_status.bad_crc", "Bad CRC", 8, nil, 0x08)
+
+f.type = ProtoField.string("superbitrf.type", "Packet type")
+f.mfg_id = ProtoField.bytes("superbitrf.mfg_id", "Manufacturer ID")
+f.header = ProtoField.uint16("superbitrf.header", "Header", base.HEX)
+f.bind_sum1 = ProtoField.uint16("superbitrf.bind.sum1", "Checksum 1", base.HEX)
+f.bind_sum2 = ProtoField.uint16("superbitrf.bind.sum2", "Checksum 2", base.HEX)
+f.bind_channels = ProtoField.uint8("superbitrf.bind.num_channels", "Number of channels", base.DEC)
+f.bind_protocol = ProtoField.uint8("superbitrf.bind.protocol", "Protocol", base.HEX)
+f.cmd_channel = ProtoField.uint8("superbitrf.command.channel", "Channel", base.DEC)
+f.cmd_value = ProtoField.uint16("superbitrf.command.value", "Value", base.DEC)
+f.data = ProtoField.bytes("superbitrf.data", "Data")
+
+dsm.prefs.resolution = Pref.enum("Command resolution", 11, "The servo resolution of command packets",
+	{{1, "10 bit", 10}, {2, "11 bit", 11}}, false)
+
+local function bind_sum(buf, from, to, sum)
+	for i = from, to do
+		sum = sum + buf(i, 1):uint()
+	end
+	return bit32.band(sum, 0xFFFF)
+end
+
+-- A bind packet repeats the inverted MFG id and has two checksums
+local function is_bind(buf)
+	if buf:len() ~= 16 or buf(0, 4):bytes() ~= buf(4, 4):bytes() then
+		return false
+	end
+	return buf(8, 2):uint() == bind_sum(buf, 0, 7, 384 - 0x10)
+end
+
+local function dissect_bind(buf, tree)
+	tree:add(f.type, "Bind")
+	tree:add(f.mfg_id, buf(0, 4)):append_text(" (inverted)")
+	tree:add(f.bind_sum1, buf(8, 2))
+	tree:add(f.bind_channels, buf(11, 1))
+	tree:add(f.bind_protocol, buf(12, 1))
+	tree:add(f.bind_sum2, buf(14, 2))
+	return "Bind"
+end
+
+local function dissect_command(buf, tree)
+	local shift = 10
+	local mask = 0x03FF
+	if dsm.prefs.resolution == 11 then
+		shift = 11
+		mask = 0x07FF
+	end
+
+	tree:add(f.type, "Command")
+	tree:add(f.header, buf(0, 2))
+	for i = 2, 14, 2 do
+		local word = buf(i, 2):uint()
+		if word ~= 0xFFFF then
+			local chan = tree:add(f.cmd_channel, buf(i, 2), bit32.band(bit32.rshift(word, shift), 0x0F))
+			chan:add(f.cmd_value, buf(i, 2), bit32.band(word, mask))
+		end
+	end
+	return "Command"
+end
+
+local function dissect_data(buf, tree)
+	tree:add(f.type, "Data")
+	tree:add(f.header, buf(0, 2))
+	if buf:len() > 2 then
+		tree:add(f.data, buf(2))
+	end
+	return "Data"
+end
+
+function dsm.dissector(buf, pinfo, root)
+	pinfo.cols.protocol = "DSM"
+	local tree = root:add(dsm, buf())
+
+	-- The capture header
+	local flags = buf(6, 1):uint()
+	tree:add_le(f.timestamp, buf(0, 4))
+	tree:add(f.channel, buf(4, 1))
+	tree:add(f.sop_col, buf(5, 1))
+	local flag_tree = tree:add(f.flags, buf(6, 1))
+	flag_tree:add(f.flag_error, buf(6, 1))
+	flag_tree:add(f.flag_crc, buf(6, 1))
+	flag_tree:add(f.flag_telemetry, buf(6, 1))
+	local rssi = tree:add(f.rssi, buf(7, 1))
+	rssi:add(f.rssi_sop, buf(7, 1))
+	local status = tree:add(f.rx_status, buf(8, 1))
+	status:add(f.rx_bad_crc, buf(8, 1))
+
+	-- The DSM packet
+	local packet = buf(9):tvb()
+	local info
+	if bit32.band(flags, CAPTURE_FLAG_TELEMETRY) ~= 0 then
+		tree:add(f.type, "Telemetry")
+		tree:add(f.data, packet())
+		info = "Telemetry"
+	elseif packet:len() < 2 then
+		info = "Runt"
+	elseif is_bind(packet) then
+		info = dissect_bind(packet, tree)
+	elseif packet:len() == 16 and (command_header == nil or packet(0, 2):uint() == command_header) then
+		-- Data packets use the command header + 1 or + 2 (packet loss bit)
+		command_header = packet(0, 2):uint()
+		info = dissect_command(packet, tree)
+	else
+		info = dissect_data(packet, tree)
+	end
+
+	pinfo.cols.info = string.format("ch %2u %s%s", buf(4, 1):uint(), info,
+		bit32.band(flags, CAPTURE_FLAG_ERROR) ~= 0 and " [error]" or "")
+end
+
+function dsm.init()
+	command_header = nil
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, dsm)
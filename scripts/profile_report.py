@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+#
+# profile_report.py: Report the code size and hop time of the build profiles
+# Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Every profile is build from a clean tree and the sections of src/usbrf.elf
+# are compared against the flash budget behind the bootloader. With --port the
+# profile is also flashed and the hop time is read with the console command spi.
+
+from __future__ import print_function
+
+import os
+import re
+import subprocess
+import sys
+import termios
+import time
+
+from optparse import OptionParser
+
+PROFILES = ["release", "release-size", "release-speed", "debug"]
+ROM_SIZE = 122 * 1024				# The rom region of stm32f103cbt6.ld
+BOOTLOADER_SIZE = 0x2000			# The text offset of BOARD=2
+RAMFUNC_SIZE = 4 * 1024				# The ramfunc_rom region of stm32f103cbt6.ld
+CONSOLE_BAUDRATE = termios.B1200	# CDCACM_CONSOLE_BAUDRATE
+
+def make(src, profile, options, target):
+	args = ["make", "-C", src, "PROFILE=" + profile, "BOARD=" + options.board]
+	if options.prefix:
+		args.append("PREFIX=" + options.prefix)
+	if options.bmp_port:
+		args.append("BMP_PORT=" + options.bmp_port)
+	subprocess.check_call(args + [target])
+
+def sections(elf, prefix):
+	"""Return the size of the sections of the elf"""
+	out = subprocess.check_output([prefix + "-size", "-A", elf]).decode()
+	sizes = {}
+	for line in out.splitlines():
+		fields = line.split()
+		if len(fields) == 3 and fields[0].startswith("."):
+			sizes[fields[0]] = int(fields[1])
+	return sizes
+
+def console_hop(port):
+	"""Read the hop cycles with the console command spi"""
+	fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+	try:
+		attr = termios.tcgetattr(fd)
+		attr[0] = attr[1] = attr[3] = 0
+		attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+		attr[4] = attr[5] = CONSOLE_BAUDRATE
+		termios.tcsetattr(fd, termios.TCSANOW, attr)
+		termios.tcflush(fd, termios.TCIOFLUSH)
+
+		os.write(fd, b"spi\r\n")
+		out = b""
+		end = time.time() + 2
+		while b"OK" not in out and time.time() < end:
+			out += os.read(fd, 256)
+	finally:
+		os.close(fd)
+
+	match = re.search(r"div (\d+).*?hop (\d+) cycles", out.decode(errors="replace"), re.S)
+	if not match:
+		return None
+	return (int(match.group(1)), int(match.group(2)))
+
+def main():
+	parser = OptionParser(usage="%prog [options] [PROFILE...]")
+	parser.add_option("-b", "--board", dest="board", default="2",
+			help="The board to build for (default 2)")
+	parser.add_option("-p", "--port", dest="port",
+			help="Flash every profile and read the hop time from the console on this serial port")
+	parser.add_option("-m", "--bmp-port", dest="bmp_port",
+			help="Flash with the black magic probe on this port")
+	parser.add_option("-w", "--wait", dest="wait", type="float", default=3,
+			help="The seconds to wait for the dongle after flashing (default 3)")
+	parser.add_option("--prefix", dest="prefix", default="arm-none-eabi",
+			help="The toolchain prefix (default arm-none-eabi)")
+	(options, args) = parser.parse_args()
+	profiles = args or PROFILES
+	for profile in profiles:
+		if profile not in PROFILES:
+			parser.error("Unknown profile %s" % profile)
+
+	src = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src")
+	budget = ROM_SIZE - (BOOTLOADER_SIZE if options.board == "2" else 0)
+	results = []
+	for profile in profiles:
+		make(src, profile, options, "clean")
+		make(src, profile, options, "usbrf.elf")
+		sizes = sections(os.path.join(src, "usbrf.elf"), options.prefix)
+
+		hop = None
+		if options.port:
+			make(src, profile, options, "flash")
+			time.sleep(options.wait)
+			hop = console_hop(options.port)
+		results.append((profile, sizes, hop))
+
+	print("%-14s %7s %6s %6s %8s %7s %9s" % ("profile", "text", "data", "bss", "ramfunc", "free", "hop"))
+	for (profile, sizes, hop) in results:
+		text = sizes.get(".text", 0)
+		data = sizes.get(".data", 0)
+		ramfunc = sizes.get(".ramfunc", 0)
+		free = budget - text - data
+		hop_str = "%u@div%u" % (hop[1], hop[0]) if hop else "-"
+		print("%-14s %7u %6u %6u %8u %7d %9s" % (profile, text, data, sizes.get(".bss", 0), ramfunc, free, hop_str))
+		if free < 0 or ramfunc > RAMFUNC_SIZE:
+			print("%s does not fit in the flash" % profile, file=sys.stderr)
+
+if __name__ == "__main__":
+	main()
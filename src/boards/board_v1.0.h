@@ -56,6 +56,7 @@
 /* Define the CYRF6936 chip */
 #define CYRF_DEV_SPI				SPI1							/**< The SPI connection number */
 #define CYRF_DEV_SPI_CLK			RCC_APB2ENR_SPI1EN				/**< The SPI clock */
+#define CYRF_DEV_SPI_MAX_DIV		SPI_CR1_BAUDRATE_FPCLK_DIV_32	/**< The fastest SPI clock divider (2.25MHz on the 72MHz APB2, the CYRF6936 allows 4MHz) */
 #define CYRF_DEV_SS_PORT			GPIOA							/**< The SPI SS port */
 #define CYRF_DEV_SS_PIN				GPIO4							/**< The SPI SS pin */
 #define CYRF_DEV_SCK_PORT			GPIOA							/**< The SPI SCK port */
@@ -73,11 +74,33 @@
 #define CYRF_DEV_IRQ_EXTI			EXTI3							/**< The IRQ EXTI for the interrupt */
 #define CYRF_DEV_IRQ_ISR			exti3_isr						/**< The IRQ ISR function for the interrupt */
 #define CYRF_DEV_IRQ_NVIC			NVIC_EXTI3_IRQ					/**< The IRQ NVIC for the interrupt */
+#define CYRF_DEV_IRQ_CAPTURE		4								/**< The DSM timer channel that captures the IRQ pin (PA3 is TIM2_CH4) */
 
 /* Define the DSM timer */
 #define TIMER_DSM					TIM2							/**< The DSM timer */
 #define TIMER_DSM_NVIC				NVIC_TIM2_IRQ					/**< The DSM timer NVIC */
 #define TIMER_DSM_IRQ				tim2_isr						/**< The DSM timer function interrupt */
 
+/* Define the PPM servo output (optional) */
+#define USE_SERVO_PPM				1								/**< If the board has a PPM output */
+#define SERVO_PPM_TIMER				TIM3							/**< The PPM timer */
+#define SERVO_PPM_TIMER_CLK			RCC_APB1ENR_TIM3EN				/**< The PPM timer clock */
+#define SERVO_PPM_OC				TIM_OC4							/**< The PPM timer output compare */
+#define SERVO_PPM_NVIC				NVIC_TIM3_IRQ					/**< The PPM timer NVIC */
+#define SERVO_PPM_IRQ				tim3_isr						/**< The PPM timer function interrupt */
+#define SERVO_PPM_GPIO_PORT			GPIOB							/**< The PPM GPIO port */
+#define SERVO_PPM_GPIO_PIN			GPIO1							/**< The PPM GPIO pin */
+#define SERVO_PPM_GPIO_CLK			RCC_APB2ENR_IOPBEN				/**< The PPM GPIO clock */
+
+/* Define the serial servo output for SBUS/SRXL (optional) */
+#define USE_SERVO_SERIAL			1								/**< If the board has a serial servo output */
+#define SERVO_SERIAL_USART			USART2							/**< The serial output USART */
+#define SERVO_SERIAL_USART_CLK		RCC_APB1ENR_USART2EN			/**< The serial output USART clock */
+#define SERVO_SERIAL_GPIO_PORT		GPIOA							/**< The serial output TX GPIO port */
+#define SERVO_SERIAL_GPIO_PIN		GPIO2							/**< The serial output TX GPIO pin */
+#define SERVO_SERIAL_GPIO_CLK		RCC_APB2ENR_IOPAEN				/**< The serial output TX GPIO clock */
+#define SERVO_SERIAL_DMA			DMA1							/**< The serial output TX DMA */
+#define SERVO_SERIAL_DMA_CHANNEL	DMA_CHANNEL7					/**< The serial output TX DMA channel */
+
 
 #endif /* BOARD_V1_0_H_ */
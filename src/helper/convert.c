@@ -23,6 +23,18 @@
 
 #include "convert.h"
 
+/**
+ * The radio word layout for the different resolutions, indexed by the resolution
+ */
+static const struct {
+	uint8_t chan_shift;							/**< The shift of the channel number in the radio word */
+	int16_t value_mask;							/**< The mask of the value in the radio word */
+	uint8_t us_shift;							/**< The shift from the radio value to microseconds */
+} convert_resolution[2] = {
+	{10, 0x03FF, 0},							// 10 bit resolution
+	{11, 0x07FF, 1},							// 11 bit resolution
+};
+
 /**
  * Initialize the buffer structure
  */
@@ -86,7 +98,8 @@ void convert_set_insert_cb(struct Buffer *buffer, void (*buffer_insert_cb)(void)
  * The maximum insert size from the buffer
  */
 uint16_t convert_insert_size(struct Buffer *buffer) {
-	return MAX_BUFFER - convert_extract_size(buffer);
+	// One byte is kept free, otherwise a full buffer looks empty
+	return MAX_BUFFER - 1 - convert_extract_size(buffer);
 }
 
 /**
@@ -116,3 +129,114 @@ void convert_radio_to_channels(uint8_t* data, uint8_t nb_channels, bool is_11bit
 			channels[chan] = val;
 	}
 }
+
+/**
+ * Convert normalized channel values to the 7 radio words of a packet, the inverse of convert_radio_to_channels
+ * Unused words are filled with 0xFFFF, which the receivers ignore.
+ * @param[in] channels The normalized channel values (-CONVERT_NORM_MAX to CONVERT_NORM_MAX)
+ * @param[in] first The first channel number in this packet
+ * @param[in] nb_channels The number of channels to put in this packet (maximum 7)
+ * @param[in] is_11bit Whether the transmitter uses 11 bit resolution
+ * @param[out] data The 14 command bytes of the packet
+ */
+void convert_channels_to_radio(int16_t *channels, uint8_t first, uint8_t nb_channels, bool is_11bit, uint8_t *data) {
+	int i;
+	const uint8_t chan_shift = convert_resolution[is_11bit].chan_shift;
+	const int16_t value_mask = convert_resolution[is_11bit].value_mask;
+
+	for (i = 0; i < 7; i++) {
+		uint16_t word = 0xFFFF;
+
+		if (i < nb_channels) {
+			int32_t norm = channels[first + i];
+			norm = (norm > CONVERT_NORM_MAX)? CONVERT_NORM_MAX : (norm < -CONVERT_NORM_MAX)? -CONVERT_NORM_MAX : norm;
+			word = ((first + i) << chan_shift) | ((norm + CONVERT_NORM_MAX) * value_mask / (2 * CONVERT_NORM_MAX));
+		}
+
+		data[2*i] = word >> 8;
+		data[2*i+1] = word & 0xFF;
+	}
+}
+
+/**
+ * Initialize a servo channel frame
+ * @param[out] frame The frame that needs to be initialized
+ * @param[in] nb_channels The number of channels the transmitter is sending
+ * @param[in] failsafe_us The failsafe value in microseconds of the CONVERT_MAX_CHANNELS channels
+ */
+void convert_frame_init(struct ChannelFrame *frame, uint8_t nb_channels, const uint16_t *failsafe_us) {
+	int i;
+
+	// Start with the failsafe values until the first packet is received
+	for (i = 0; i < CONVERT_CHANNEL_SLOTS; i++) {
+		frame->raw[i] = 0;
+		frame->us[i] = (i < CONVERT_MAX_CHANNELS)? failsafe_us[i] : 0;
+		frame->age[i] = CONVERT_AGE_MAX;
+	}
+
+	frame->updated = 0;
+	frame->nb_channels = (nb_channels > CONVERT_MAX_CHANNELS)? CONVERT_MAX_CHANNELS : nb_channels;
+	frame->failsafe = true;
+}
+
+/**
+ * Convert a radio packet into the persistent servo channel frame
+ * Only the channels in this packet are updated, so the A/B halves of a frame merge. Channels
+ * outside the frame are written into the unused last slot, so this doesn't branch per word.
+ * @param[in,out] frame The frame that gets updated
+ * @param[in] data The 14 command bytes of the packet
+ * @param[in] is_11bit Whether the transmitter uses 11 bit resolution
+ */
+void convert_radio_to_frame(struct ChannelFrame *frame, uint8_t *data, bool is_11bit) {
+	int i;
+	uint16_t updated = 0;
+	const uint8_t chan_shift = convert_resolution[is_11bit].chan_shift;
+	const int16_t value_mask = convert_resolution[is_11bit].value_mask;
+	const uint8_t us_shift = convert_resolution[is_11bit].us_shift;
+
+	// Age all the channels (saturating)
+	for (i = 0; i < CONVERT_CHANNEL_SLOTS; i++)
+		frame->age[i] += (frame->age[i] != CONVERT_AGE_MAX);
+
+	for (i = 0; i < 7; i++) {
+		const int16_t tmp = ((data[2*i]<<8) + data[2*i+1]) & 0x7FFF;
+		const int16_t val = tmp & value_mask;
+		uint8_t chan = (tmp >> chan_shift) & 0x0F;
+
+		chan = (chan < frame->nb_channels)? chan : CONVERT_CHANNEL_SLOTS - 1;
+		frame->raw[chan] = val;
+		frame->us[chan] = CONVERT_US_OFFSET + (val >> us_shift);
+		frame->age[chan] = 0;
+		updated |= 1 << chan;
+	}
+
+	frame->updated = updated & ((1 << frame->nb_channels) - 1);
+	frame->failsafe = false;
+}
+
+/**
+ * Update the servo channel frame after a missed packet
+ * After the maximum amount of missed packets the failsafe values are applied, a failsafe
+ * value of zero holds the last received value of that channel.
+ * @param[in,out] frame The frame that gets updated
+ * @param[in] missed_packets The amount of missed packets since the last receive
+ * @param[in] max_missed_packets The amount of missed packets before the failsafe values are applied
+ * @param[in] failsafe_us The failsafe value in microseconds of the CONVERT_MAX_CHANNELS channels
+ */
+void convert_frame_missed(struct ChannelFrame *frame, uint8_t missed_packets, uint8_t max_missed_packets, const uint16_t *failsafe_us) {
+	int i;
+
+	for (i = 0; i < CONVERT_CHANNEL_SLOTS; i++)
+		frame->age[i] += (frame->age[i] != CONVERT_AGE_MAX);
+	frame->updated = 0;
+
+	// Check if we need to go into failsafe
+	if (frame->failsafe || missed_packets < max_missed_packets)
+		return;
+
+	for (i = 0; i < CONVERT_MAX_CHANNELS; i++) {
+		const uint16_t failsafe = failsafe_us[i];
+		frame->us[i] = (failsafe != 0)? failsafe : frame->us[i];
+	}
+	frame->failsafe = true;
+}
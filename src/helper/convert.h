@@ -44,6 +44,30 @@ void convert_set_insert_cb(struct Buffer *buffer, void (*buffer_insert_cb)(void)
 uint16_t convert_insert_size(struct Buffer *buffer);
 uint16_t convert_extract_size(struct Buffer *buffer);
 
+/* The servo channel frame definitions */
+#define CONVERT_MAX_CHANNELS		14			/**< The maximum amount of servo channels in a frame */
+#define CONVERT_CHANNEL_SLOTS		16			/**< The amount of channel slots (a channel number is 4 bits) */
+#define CONVERT_US_OFFSET			988			/**< The pulse width in microseconds of a zero radio value */
+#define CONVERT_AGE_MAX				0xFF		/**< The maximum age of a channel in packets */
+#define CONVERT_NORM_MAX			1000		/**< The maximum normalized channel value, the minimum is the negative */
+
+/**
+ * The servo channel frame, persistent over the A/B packets
+ */
+struct ChannelFrame {
+	int16_t raw[CONVERT_CHANNEL_SLOTS];			/**< The last raw radio value of every channel */
+	uint16_t us[CONVERT_CHANNEL_SLOTS];			/**< The output pulse width in microseconds of every channel */
+	uint8_t age[CONVERT_CHANNEL_SLOTS];			/**< The amount of packets since the channel was last received */
+	uint16_t updated;							/**< Bitmask of the channels updated by the last packet */
+	uint8_t nb_channels;						/**< The number of channels in the frame */
+	bool failsafe;								/**< When the failsafe values are active */
+};
+
 void convert_radio_to_channels(uint8_t* data, uint8_t nb_channels, bool is_11bit, int16_t* channels);
+void convert_channels_to_radio(int16_t *channels, uint8_t first, uint8_t nb_channels, bool is_11bit, uint8_t *data);
+
+void convert_frame_init(struct ChannelFrame *frame, uint8_t nb_channels, const uint16_t *failsafe_us);
+void convert_radio_to_frame(struct ChannelFrame *frame, uint8_t *data, bool is_11bit);
+void convert_frame_missed(struct ChannelFrame *frame, uint8_t missed_packets, uint8_t max_missed_packets, const uint16_t *failsafe_us);
 
 #endif /* PROTOCOL_CONVERT_H_ */
@@ -0,0 +1,26 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELPER_CRC_H_
+#define HELPER_CRC_H_
+
+/* The external functions */
+uint16_t crc16_ccitt(uint16_t crc, const uint8_t *data, uint16_t length);
+
+#endif /* HELPER_CRC_H_ */
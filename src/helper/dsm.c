@@ -19,6 +19,8 @@
 
 #include "../modules/config.h"
 #include "../modules/cyrf6936.h"
+#include "../modules/ramfunc.h"
+#include "crc.h"
 #include "dsm.h"
 
 /* The PN codes */
@@ -83,7 +85,6 @@ const uint8_t pn_bind[] = { 0x98, 0x88, 0x1B, 0xE4, 0x30, 0x79, 0x03, 0x84 };
 
 /*The CYRF initial config, binding config and transfer config */
 const uint8_t cyrf_config[][2] = {
-		{CYRF_MODE_OVERRIDE, CYRF_RST},											// Reset the device
 		{CYRF_CLK_EN, CYRF_RXF},												// Enable the clock
 		{CYRF_AUTO_CAL_TIME, 0x3C},												// From manual, needed for initialization
 		{CYRF_AUTO_CAL_OFFSET, 0x14},											// From manual, needed for initialization
@@ -197,18 +198,123 @@ void dsm_generate_channels_dsmx(uint8_t mfg_id[], uint8_t *channels) {
  * @param[in] data_col The DATA code column number
  * @param[in] crc_seed The cec seed that needs to be set
  */
-void dsm_set_channel(uint8_t channel, bool is_dsm2, uint8_t sop_col, uint8_t data_col, uint16_t crc_seed) {
+void RAMFUNC dsm_set_channel(uint8_t channel, bool is_dsm2, uint8_t sop_col, uint8_t data_col, uint16_t crc_seed) {
+	// Update the CRC, the register writes are inlined so the hop stays in RAM
+	cyrf_write_register_inline(CYRF_CRC_SEED_LSB, crc_seed & 0xff);
+	cyrf_write_register_inline(CYRF_CRC_SEED_MSB, crc_seed >> 8);
+	dsm_set_channel_codes(channel, is_dsm2, sop_col, data_col);
+}
+
+/**
+ * Set the current channel with SOP and data code, but keep the CRC seed
+ * @param[in] channel The channel that needs to be set
+ * @param[in] is_dsm2 Whether we want to set a DSM2 channel
+ * @param[in] sop_col The SOP code column number
+ * @param[in] data_col The DATA code column number
+ */
+void RAMFUNC dsm_set_channel_codes(uint8_t channel, bool is_dsm2, uint8_t sop_col, uint8_t data_col) {
 	uint8_t pn_row;
 	pn_row = is_dsm2? channel % 5 : (channel-2) % 5;
 
-	// Update the CRC, SOP and Data code
-	cyrf_set_crc_seed(crc_seed);
-	cyrf_set_sop_code(pn_codes[pn_row][sop_col]);
-	cyrf_set_data_code(pn_codes[pn_row][data_col]);
+	// Update the SOP and Data code
+	cyrf_write_block_inline(CYRF_SOP_CODE, pn_codes[pn_row][sop_col], 8);
+	cyrf_write_block_inline(CYRF_DATA_CODE, pn_codes[pn_row][data_col], 16);
 
 	// Change channel
-	cyrf_set_channel(channel);
+	cyrf_write_register_inline(CYRF_CHANNEL, channel);
+
+	DEBUG(dsm, "Set channel: 0x%02X (is_dsm2: 0x%02X, pn_row: 0x%02X, data_col: 0x%02X, sop_col: 0x%02X)",
+					channel, is_dsm2, pn_row, data_col, sop_col);
+}
+
+/**
+ * Check the CRC of a packet received with the hardware CRC check disabled against both seeds
+ * The CRC-16 CCITT is assumed to cover the length byte and the payload (not verified on hardware yet)
+ * @param[in] packet The received payload
+ * @param[in] length The length of the payload
+ * @param[in] crc The received CRC from CYRF_RX_CRC_MSB and CYRF_RX_CRC_LSB
+ * @param[in] seed The CRC seed of the B packets ((mfg_id[0] << 8) + mfg_id[1]), the A packets use the inverse
+ * @param[out] crc_seed The seed that matched
+ * @return True when one of the seeds matched
+ */
+bool RAMFUNC dsm_check_crc(const uint8_t *packet, uint8_t length, uint16_t crc, uint16_t seed, uint16_t *crc_seed) {
+	if (length == 0)
+		return false;
+
+	// Try the seed of the A packets, then the seed of the B packets
+	if (crc16_ccitt(crc16_ccitt(~seed, &length, 1), packet, length) == crc) {
+		*crc_seed = ~seed;
+		return true;
+	}
+	if (crc16_ccitt(crc16_ccitt(seed, &length, 1), packet, length) == crc) {
+		*crc_seed = seed;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Survey the noise on all the channels
+ * @param[in] max_channel The highest channel to survey (at most DSM_MAX_CHANNEL)
+ * @param[out] noise The RSSI of every channel
+ */
+void dsm_survey(uint8_t max_channel, uint8_t noise[]) {
+	uint8_t i;
+
+	if (max_channel > DSM_MAX_CHANNEL)
+		max_channel = DSM_MAX_CHANNEL;
+	for (i = 0; i <= max_channel; i++)
+		noise[i] = cyrf_measure_rssi(i);
+
+	DEBUG(dsm, "Surveyed 0x%02X channels", max_channel + 1);
+}
+
+/**
+ * Select the quietest pair of DSM2 channels which are at least DSM_DSM2_SEPARATION apart
+ * The pair with the lowest noise on its noisiest channel wins, ties go to the lowest total noise.
+ * @param[in] noise The RSSI of every channel from the survey
+ * @param[in] max_channel The highest channel that can be used (at most DSM_MAX_CHANNEL)
+ * @param[out] channels The two selected channels
+ */
+void dsm_select_channels_dsm2(uint8_t noise[], uint8_t max_channel, uint8_t channels[]) {
+	uint16_t best = 0xFFFF;
+	uint8_t a, b;
+
+	// Keep the fixed channels when no pair is far enough apart
+	channels[0] = 0x15;
+	channels[1] = 0x3C;
+
+	if (max_channel > DSM_MAX_CHANNEL)
+		max_channel = DSM_MAX_CHANNEL;
+	for (a = 0; a + DSM_DSM2_SEPARATION <= max_channel; a++) {
+		for (b = a + DSM_DSM2_SEPARATION; b <= max_channel; b++) {
+			uint16_t worst = (noise[a] > noise[b])? noise[a] : noise[b];
+			uint16_t score = (worst << 8) | (noise[a] + noise[b]);
+			if (score < best) {
+				best = score;
+				channels[0] = a;
+				channels[1] = b;
+			}
+		}
+	}
+
+	DEBUG(dsm, "Selected DSM2 channels 0x%02X (RSSI %d) and 0x%02X (RSSI %d)", channels[0], noise[channels[0]], channels[1], noise[channels[1]]);
+}
+
+/**
+ * Select the quietest channel for binding
+ * @param[in] noise The RSSI of every channel from the survey
+ * @param[in] max_channel The highest channel that can be used (at most DSM_MAX_CHANNEL)
+ * @return The quietest channel
+ */
+uint8_t dsm_select_bind_channel(uint8_t noise[], uint8_t max_channel) {
+	uint8_t i, channel = 0;
+
+	if (max_channel > DSM_MAX_CHANNEL)
+		max_channel = DSM_MAX_CHANNEL;
+	for (i = 1; i <= max_channel; i++)
+		if (noise[i] < noise[channel])
+			channel = i;
 
-	DEBUG(dsm, "Set channel: 0x%02X (is_dsm2: 0x%02X, pn_row: 0x%02X, data_col: 0x%02X, sop_col: 0x%02X, crc_seed: 0x%04X)",
-					channel, is_dsm2, pn_row, data_col, sop_col, crc_seed);
+	return channel;
 }
@@ -31,23 +31,34 @@
 #define DSM_BIND_SEND_TIME			1000		/**< Time between sending bind packets */
 #define DSM_SEND_TIME				2200		/**< Time between sending both Channel A and Channel B */
 #define DSM_CHA_CHB_SEND_TIME		400			/**< Time between Channel A and Channel B send */
+#define DSM_SEND_TIME_11MS			1100		/**< Time between sending both Channel A and Channel B with 11ms frames */
+#define DSM_RECV_TIME_11MS			1100		/**< Time before timeout when trying to receive with 11ms frames */
 
 /* The maximum channekl number for DSM2 and DSMX */
 #define DSM_MAX_CHANNEL				0x4F		/**< Maximum channel number used for DSM2 and DSMX */
 #define DSM_BIND_PACKETS			300			/**< The amount of bind packets to send */
+#define DSM_DSM2_SEPARATION			0x10		/**< The minimum distance between the two DSM2 channels */
 
 /* The different kind of protocol definitions DSM2 and DSMX with 1 and 2 packets of data */
 enum dsm_protocol {
 	DSM_DSM2_1			= 0x01,		/**< The original DSM2 protocol with 1 packet of data */
-	DSM_DSM2_2			= 0x02,		/**< The original DSM2 protocol with 2 packets of data */
+	DSM_DSM2_2			= 0x02,		/**< The original DSM2 protocol with 2 packets of data in 11ms frames */
 	DSM_DSMX_1			= 0xA2,		/**< The original DSMX protocol with 1 packet of data */
-	DSM_DSMX_2			= 0xB2,		/**< The original DSMX protocol with 2 packets of data */
+	DSM_DSMX_2			= 0xB2,		/**< The original DSMX protocol with 2 packets of data in 11ms frames */
 };
 #define IS_DSM2(x)			(x == DSM_DSM2_1 || x == DSM_DSM2_2 || usbrf_config.dsm_force_dsm2)
 #define IS_DSMX(x)			(!IS_DSM2(x))
+#define IS_11MS(x)			(x == DSM_DSM2_2 || x == DSM_DSMX_2)
+
+/* The frame timing, the 2 packet protocols send a frame every 11ms */
+#define DSM_FRAME_TIME(x)	(IS_11MS(x)? DSM_SEND_TIME_11MS : DSM_SEND_TIME)
+#define DSM_RECV_TIMEOUT(x)	(IS_11MS(x)? DSM_RECV_TIME_11MS : DSM_RECV_TIME)
 
 #define CHECK_MFG_ID(protocol, packet, id) ((IS_DSM2(protocol) && packet[0] == (~id[2]&0xFF) && packet[1] == (~id[3]&0xFF)) || \
 		(IS_DSMX(protocol) && packet[0] == id[2] && packet[1] == id[3]))
+#define CHECK_MFG_ID_DATA(protocol, packet, id) ((IS_DSM2(protocol) && packet[0] == (~id[2]&0xFF) && (packet[1] == ((~id[3]+1)&0xFF) || packet[1] == ((~id[3]+2)&0xFF))) || \
+		(IS_DSMX(protocol) && packet[0] == id[2] && (packet[1] == id[3]+1 || packet[1] == id[3]+2)))
+#define CHECK_MFG_ID_BOTH(protocol, packet, id) (CHECK_MFG_ID(protocol, packet, id) || CHECK_MFG_ID_DATA(protocol, packet, id))
 
 /* The different kind of resolutions the commands can be */
 enum dsm_resolution {
@@ -58,7 +69,7 @@ enum dsm_resolution {
 /* External variables used in DSM2 and DSMX */
 extern const uint8_t pn_codes[5][9][8];			/**< The pn_codes for the DSM2/DSMX protocol */
 extern const uint8_t pn_bind[];					/**< The pn_code used during binding */
-extern const uint8_t cyrf_config[][2];			/**< The CYRF DSM configuration during boot */
+extern const uint8_t cyrf_config[][2];			/**< The CYRF DSM configuration after a reset */
 extern const uint8_t cyrf_bind_config[][2];		/**< The CYRF DSM binding configuration */
 extern const uint8_t cyrf_transfer_config[][2];	/**< The CYRF DSM transfer configuration */
 
@@ -87,5 +98,10 @@ uint16_t dsm_bind_config_size(void);
 uint16_t dsm_transfer_config_size(void);
 void dsm_generate_channels_dsmx(uint8_t mfg_id[], uint8_t *channels);
 void dsm_set_channel(uint8_t channel, bool is_dsm2, uint8_t sop_col, uint8_t data_col, uint16_t crc_seed);
+void dsm_set_channel_codes(uint8_t channel, bool is_dsm2, uint8_t sop_col, uint8_t data_col);
+bool dsm_check_crc(const uint8_t *packet, uint8_t length, uint16_t crc, uint16_t seed, uint16_t *crc_seed);
+void dsm_survey(uint8_t max_channel, uint8_t noise[]);
+void dsm_select_channels_dsm2(uint8_t noise[], uint8_t max_channel, uint8_t channels[]);
+uint8_t dsm_select_bind_channel(uint8_t noise[], uint8_t max_channel);
 
 #endif /* PROTOCOL_DSM_H_ */
@@ -0,0 +1,151 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <libopencm3/cm3/common.h>
+
+#include "tunnel.h"
+
+/* The distance between two sequence numbers */
+#define TUNNEL_SEQ_DIFF(a, b)		(((a) - (b)) & (TUNNEL_SEQ_NB - 1))
+
+/**
+ * Initialize the tunnel
+ * @param[in] tunnel The tunnel
+ * @param[in] output The callback for the data received in order
+ */
+void tunnel_init(struct Tunnel *tunnel, tunnel_output output) {
+	memset(tunnel, 0, sizeof(struct Tunnel));
+	tunnel->output = output;
+}
+
+/**
+ * Create the next tunnel packet, resends the oldest frame which wasn't acknowledged in time,
+ * else sends new data from the buffer when the window has room, else only acknowledges
+ * @param[in] tunnel The tunnel
+ * @param[in] buffer The buffer with the data to send
+ * @param[out] packet The packet with room for TUNNEL_HEADER + TUNNEL_MAX_DATA bytes
+ * @param[in] flush Also send a partial frame, else new data waits until a full frame is available
+ * @return The length of the packet
+ */
+uint8_t tunnel_create(struct Tunnel *tunnel, struct Buffer *buffer, uint8_t *packet, bool flush) {
+	struct TunnelFrame *frame = NULL;
+	uint8_t seq, i, sack = 0;
+
+	tunnel->tx_counter++;
+	tunnel->stats.tx_packets++;
+
+	// Find the oldest frame which needs to be send again
+	for (seq = tunnel->tx_base; seq != tunnel->tx_next; seq = (seq + 1) & (TUNNEL_SEQ_NB - 1)) {
+		struct TunnelFrame *f = &tunnel->tx_window[seq % TUNNEL_WINDOW];
+		if (!f->acked && (uint8_t)(tunnel->tx_counter - f->sent_at) >= TUNNEL_RETRY_SLOTS) {
+			frame = f;
+			tunnel->stats.tx_retransmits++;
+			break;
+		}
+	}
+
+	// Take new data when the window isn't full
+	if (frame == NULL && TUNNEL_SEQ_DIFF(tunnel->tx_next, tunnel->tx_base) < TUNNEL_WINDOW
+			&& (convert_extract_size(buffer) >= TUNNEL_MAX_DATA || (flush && convert_extract_size(buffer) > 0))) {
+		seq = tunnel->tx_next;
+		frame = &tunnel->tx_window[seq % TUNNEL_WINDOW];
+		frame->length = convert_extract(buffer, frame->data, TUNNEL_MAX_DATA);
+		frame->acked = false;
+		tunnel->tx_next = (seq + 1) & (TUNNEL_SEQ_NB - 1);
+		tunnel->stats.tx_frames++;
+	}
+
+	// The selective acknowledgements of the frames after the next expected
+	for (i = 0; i < TUNNEL_WINDOW - 1; i++)
+		if (tunnel->rx_window[(tunnel->rx_next + 1 + i) % TUNNEL_WINDOW].length > 0)
+			sack |= (1 << i);
+	packet[1] = (tunnel->rx_next << 4) | sack;
+
+	// Only acknowledge when there is nothing to send
+	if (frame == NULL) {
+		packet[0] = 0;
+		return TUNNEL_HEADER;
+	}
+
+	frame->sent_at = tunnel->tx_counter;
+	packet[0] = (seq << 4) | frame->length;
+	memcpy(&packet[TUNNEL_HEADER], frame->data, frame->length);
+	return TUNNEL_HEADER + frame->length;
+}
+
+/**
+ * Handle a received tunnel packet, processes the acknowledgements and outputs the data in order
+ * @param[in] tunnel The tunnel
+ * @param[in] packet The received packet
+ * @param[in] length The length of the received packet
+ */
+void tunnel_receive(struct Tunnel *tunnel, uint8_t *packet, uint8_t length) {
+	struct TunnelFrame *frame;
+	uint8_t seq, ack, data_length, i;
+
+	if (length < TUNNEL_HEADER)
+		return;
+	tunnel->stats.rx_packets++;
+
+	// Slide the send window up to the acknowledgement, ignore acknowledgements outside the window
+	ack = TUNNEL_ACK(packet);
+	if (TUNNEL_SEQ_DIFF(ack, tunnel->tx_base) <= TUNNEL_SEQ_DIFF(tunnel->tx_next, tunnel->tx_base)) {
+		while (tunnel->tx_base != ack) {
+			frame = &tunnel->tx_window[tunnel->tx_base % TUNNEL_WINDOW];
+			tunnel->stats.tx_bytes_acked += frame->length;
+			frame->length = 0;
+			frame->acked = false;
+			tunnel->tx_base = (tunnel->tx_base + 1) & (TUNNEL_SEQ_NB - 1);
+		}
+
+		// Mark the selectively acknowledged frames so they aren't resend
+		for (i = 0; i < TUNNEL_WINDOW - 1; i++) {
+			seq = (ack + 1 + i) & (TUNNEL_SEQ_NB - 1);
+			if ((TUNNEL_SACK(packet) & (1 << i)) && TUNNEL_SEQ_DIFF(seq, tunnel->tx_base) < TUNNEL_SEQ_DIFF(tunnel->tx_next, tunnel->tx_base))
+				tunnel->tx_window[seq % TUNNEL_WINDOW].acked = true;
+		}
+	}
+
+	// Check if the packet contains data
+	data_length = TUNNEL_LENGTH(packet);
+	if (data_length == 0 || data_length > TUNNEL_MAX_DATA || length < TUNNEL_HEADER + data_length)
+		return;
+
+	// Frames before the receive window were already delivered
+	seq = TUNNEL_SEQ(packet);
+	frame = &tunnel->rx_window[seq % TUNNEL_WINDOW];
+	if (TUNNEL_SEQ_DIFF(seq, tunnel->rx_next) >= TUNNEL_WINDOW || frame->length > 0) {
+		tunnel->stats.rx_duplicates++;
+		return;
+	}
+	memcpy(frame->data, &packet[TUNNEL_HEADER], data_length);
+	frame->length = data_length;
+
+	// Output all the frames which are in order
+	frame = &tunnel->rx_window[tunnel->rx_next % TUNNEL_WINDOW];
+	while (frame->length > 0) {
+		if (tunnel->output != NULL)
+			tunnel->output(frame->data, frame->length);
+		tunnel->stats.rx_bytes += frame->length;
+		frame->length = 0;
+		tunnel->rx_next = (tunnel->rx_next + 1) & (TUNNEL_SEQ_NB - 1);
+		frame = &tunnel->rx_window[tunnel->rx_next % TUNNEL_WINDOW];
+	}
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELPER_TUNNEL_H_
+#define HELPER_TUNNEL_H_
+
+#include <libopencm3/cm3/common.h>
+#include "convert.h"
+
+#define TUNNEL_HEADER				2			/**< The tunnel header in front of the data */
+#define TUNNEL_MAX_DATA				12			/**< The maximum data in one tunnel packet (14 byte payload) */
+#define TUNNEL_SEQ_NB				16			/**< The amount of sequence numbers (4 bits) */
+#define TUNNEL_WINDOW				4			/**< The sliding window, the frames in flight */
+#define TUNNEL_RETRY_SLOTS			2			/**< The created packets before an unacknowledged frame is resent */
+
+/* The header layout, byte 0 is the sequence and length, byte 1 the acknowledgement and the selective acknowledgements */
+#define TUNNEL_SEQ(hdr)				((hdr)[0] >> 4)
+#define TUNNEL_LENGTH(hdr)			((hdr)[0] & 0x0F)
+#define TUNNEL_ACK(hdr)				((hdr)[1] >> 4)
+#define TUNNEL_SACK(hdr)			((hdr)[1] & 0x0F)
+
+/**
+ * The output callback for the data received in order
+ */
+typedef void (*tunnel_output)(uint8_t *data, uint8_t length);
+
+/**
+ * One frame in the send or receive window
+ */
+struct TunnelFrame {
+	uint8_t data[TUNNEL_MAX_DATA];				/**< The frame data */
+	uint8_t length;								/**< The frame data length, 0 when the slot is empty */
+	uint8_t sent_at;							/**< The packet counter when the frame was last sent */
+	bool acked;									/**< When the frame was selectively acknowledged */
+};
+
+/**
+ * The tunnel statistics
+ */
+struct TunnelStats {
+	uint32_t tx_packets;						/**< The packets created */
+	uint32_t tx_frames;							/**< The new data frames send */
+	uint32_t tx_retransmits;					/**< The data frames send again */
+	uint32_t tx_bytes_acked;					/**< The data bytes acknowledged by the other side */
+	uint32_t rx_packets;						/**< The packets received */
+	uint32_t rx_duplicates;						/**< The data frames received which were already received */
+	uint32_t rx_bytes;							/**< The data bytes delivered in order */
+};
+
+/**
+ * A reliable tunnel over one side of the data packets, with selective repeat
+ */
+struct Tunnel {
+	struct TunnelFrame tx_window[TUNNEL_WINDOW];	/**< The send window, indexed by sequence modulo the window */
+	uint8_t tx_base;							/**< The oldest unacknowledged sequence */
+	uint8_t tx_next;							/**< The next new sequence */
+	uint8_t tx_counter;							/**< The created packet counter */
+
+	struct TunnelFrame rx_window[TUNNEL_WINDOW];	/**< The frames received out of order */
+	uint8_t rx_next;							/**< The next expected sequence */
+
+	tunnel_output output;						/**< The output of the received data */
+	struct TunnelStats stats;					/**< The statistics */
+};
+
+/* External functions */
+void tunnel_init(struct Tunnel *tunnel, tunnel_output output);
+uint8_t tunnel_create(struct Tunnel *tunnel, struct Buffer *buffer, uint8_t *packet, bool flush);
+void tunnel_receive(struct Tunnel *tunnel, uint8_t *packet, uint8_t length);
+
+#endif /* HELPER_TUNNEL_H_ */
@@ -0,0 +1,225 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+#include "config.h"
+#include "timer.h"
+
+/* The capture statistics */
+static struct CaptureStats capture_stats;
+static uint32_t capture_stats_time = 0;
+static uint32_t capture_stats_captured = 0;
+static uint32_t capture_stats_usb_packets = 0;
+static uint8_t capture_pcapng_opened = 0;
+
+/**
+ * Send a capture record, can be called from interrupts
+ * @param[in] type The record type
+ * @param[in] data The record after the header
+ * @param[in] length The length of the record
+ * @return False when the record was dropped
+ */
+bool capture_send(enum capture_type type, const void *data, uint8_t length) {
+	uint8_t record[sizeof(struct CaptureHeader) + CAPTURE_MAX_RECORD];
+	struct CaptureHeader *header = (struct CaptureHeader *)record;
+
+	if(length > CAPTURE_MAX_RECORD)
+		return false;
+
+	header->sync = CAPTURE_SYNC;
+	header->type = type;
+	header->length = length;
+	memcpy(&record[sizeof(struct CaptureHeader)], data, length);
+
+	// Send the record in one go, so it is never split by other output
+	return cdcacm_send((char *)record, sizeof(struct CaptureHeader) + length);
+}
+
+/**
+ * Send the pcapng section header and interface description blocks
+ * @return False when the header was dropped
+ */
+static bool capture_send_pcapng_header(void) {
+	uint32_t blocks[12];
+
+	// Section header block
+	blocks[0] = 0x0A0D0D0A;
+	blocks[1] = 28;
+	blocks[2] = 0x1A2B3C4D;					// Byte order magic
+	blocks[3] = 0x00000001;					// Version 1.0
+	blocks[4] = 0xFFFFFFFF;					// Unknown section length
+	blocks[5] = 0xFFFFFFFF;
+	blocks[6] = 28;
+
+	// Interface description block (microsecond timestamps by default)
+	blocks[7] = 0x00000001;
+	blocks[8] = 20;
+	blocks[9] = CAPTURE_LINKTYPE;
+	blocks[10] = 0;							// No snapshot length
+	blocks[11] = 20;
+
+	return cdcacm_send((char *)blocks, sizeof(blocks));
+}
+
+/**
+ * Send a captured packet as pcapng enhanced packet block
+ * @param[in] packet The captured packet
+ * @param[in] length The length of the packet including the capture header
+ * @param[in] time The receive time in 10 microseconds
+ * @return False when the packet was dropped
+ */
+static bool capture_send_pcapng(const struct CapturePacket *packet, uint8_t length, uint32_t time) {
+	uint32_t block[8 + (sizeof(struct CapturePacket) + 3) / 4];
+	uint64_t timestamp = (uint64_t)time * 10;
+	uint8_t total = 32 + ((length + 3) & ~3);
+
+	block[0] = 0x00000006;
+	block[1] = total;
+	block[2] = 0;							// Interface 0
+	block[3] = timestamp >> 32;
+	block[4] = timestamp & 0xFFFFFFFF;
+	block[5] = length;						// Captured length
+	block[6] = length;						// Original length
+	block[total/4 - 2] = 0;					// Clear the padding
+	memcpy(&block[7], packet, length);
+	block[total/4 - 1] = total;
+
+	return cdcacm_send((char *)block, total);
+}
+
+/**
+ * Capture a received packet, called from the receive callbacks
+ * @param[in] channel The RF channel the packet was received on
+ * @param[in] sop_col The SOP column
+ * @param[in] crc_inverted Whether the inverted CRC seed was used
+ * @param[in] data The received packet
+ * @param[in] length The length of the received packet
+ * @param[in] rssi The RSSI register
+ * @param[in] rx_status The RX status register
+ * @param[in] error Whether the CYRF6936 signalled an error
+ */
+void capture_packet(uint8_t channel, uint8_t sop_col, bool crc_inverted, uint8_t *data, uint8_t length, uint8_t rssi, uint8_t rx_status, bool error) {
+	struct CapturePacket packet;
+	uint32_t time;
+	bool sent;
+
+	if(!usbrf_config.capture_enable)
+		return;
+
+	// A pcapng stream must start with the header of the current section
+	if(usbrf_config.capture_format == CAPTURE_FORMAT_PCAPNG && capture_pcapng_opened != cdcacm_opened) {
+		capture_stats.captured++;
+		capture_stats.dropped++;
+		return;
+	}
+
+	time = timer_get_time();
+	if(length > CAPTURE_MAX_DATA)
+		length = CAPTURE_MAX_DATA;
+
+	packet.timestamp = time * 10;
+	packet.channel = channel;
+	packet.sop_col = sop_col;
+	packet.flags = (error? CAPTURE_FLAG_ERROR : 0) | (crc_inverted? CAPTURE_FLAG_CRC_INVERTED : 0);
+	packet.rssi = rssi;
+	packet.rx_status = rx_status;
+	memcpy(packet.data, data, length);
+
+	// Send the packet in the configured format
+	if(usbrf_config.capture_format == CAPTURE_FORMAT_PCAPNG)
+		sent = capture_send_pcapng(&packet, CAPTURE_PACKET_HEADER + length, time);
+	else
+		sent = capture_send(CAPTURE_TYPE_PACKET, &packet, CAPTURE_PACKET_HEADER + length);
+
+	// Count the packet
+	capture_stats.captured++;
+	if(!sent)
+		capture_stats.dropped++;
+}
+
+/**
+ * Capture the telemetry data the transmitter received through the tunnel
+ * @param[in] data The telemetry data
+ * @param[in] length The length of the data
+ */
+void capture_telemetry(const uint8_t *data, uint8_t length) {
+	struct CapturePacket packet;
+	uint32_t time;
+	bool sent;
+
+	if(!usbrf_config.capture_enable)
+		return;
+	if(length > CAPTURE_MAX_DATA)
+		length = CAPTURE_MAX_DATA;
+
+	// Send the data in the configured format, the pcapng stream must start with the header
+	if(usbrf_config.capture_format == CAPTURE_FORMAT_PCAPNG) {
+		if(capture_pcapng_opened != cdcacm_opened) {
+			sent = false;
+		} else {
+			time = timer_get_time();
+			memset(&packet, 0, CAPTURE_PACKET_HEADER);
+			packet.timestamp = time * 10;
+			packet.flags = CAPTURE_FLAG_TELEMETRY;
+			memcpy(packet.data, data, length);
+			sent = capture_send_pcapng(&packet, CAPTURE_PACKET_HEADER + length, time);
+		}
+	} else {
+		sent = capture_send(CAPTURE_TYPE_TELEMETRY, data, length);
+	}
+
+	// Count the telemetry with the packets
+	capture_stats.captured++;
+	if(!sent)
+		capture_stats.dropped++;
+}
+
+/**
+ * Send the capture statistics every interval, called from the main loop
+ */
+void capture_run(void) {
+	uint32_t time = timer_get_time();
+	uint8_t opened;
+
+	if(!usbrf_config.capture_enable)
+		return;
+
+	// A pcapng stream starts with a new section every time the port is opened, packets are dropped until it is queued
+	opened = cdcacm_opened;
+	if(usbrf_config.capture_format == CAPTURE_FORMAT_PCAPNG && capture_pcapng_opened != opened) {
+		if(capture_send_pcapng_header())
+			capture_pcapng_opened = opened;
+	}
+
+	if(time - capture_stats_time < CAPTURE_STATS_INTERVAL)
+		return;
+
+	// Calculate the rates of the last interval
+	capture_stats.timestamp = time * 10;
+	capture_stats.usb_packets = cdcacm_tx_packets;
+	capture_stats.capture_rate = capture_stats.captured - capture_stats_captured;
+	capture_stats.usb_rate = capture_stats.usb_packets - capture_stats_usb_packets;
+	capture_stats_captured = capture_stats.captured;
+	capture_stats_usb_packets = capture_stats.usb_packets;
+	capture_stats_time = time;
+
+	// The statistics are only available in the record format
+	if(usbrf_config.capture_format == CAPTURE_FORMAT_RECORD)
+		capture_send(CAPTURE_TYPE_STATS, &capture_stats, sizeof(struct CaptureStats));
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_CAPTURE_H_
+#define MODULES_CAPTURE_H_
+
+#include <libopencm3/cm3/common.h>
+
+#define CAPTURE_SYNC				0xA5		/**< The first byte of every capture record */
+#define CAPTURE_MAX_DATA			16			/**< The maximum packet length of the CYRF6936 */
+#define CAPTURE_MAX_RECORD			64			/**< The maximum record length after the header */
+#define CAPTURE_STATS_INTERVAL		100000		/**< The interval between statistics records in 10 microseconds (1s) */
+#define CAPTURE_LINKTYPE			147			/**< The pcapng link type (LINKTYPE_USER0) */
+
+/**
+ * The capture output formats
+ */
+enum capture_format {
+	CAPTURE_FORMAT_RECORD		= 0,			/**< The compact capture records */
+	CAPTURE_FORMAT_PCAPNG,						/**< A pcapng stream with CapturePacket as link-layer header */
+};
+
+/**
+ * The capture record types
+ */
+enum capture_type {
+	CAPTURE_TYPE_PACKET			= 0,			/**< A received radio packet */
+	CAPTURE_TYPE_STATS,							/**< The capture statistics */
+	CAPTURE_TYPE_LINKSTATS,						/**< The link statistics of one hop (struct LinkStatsHop) */
+	CAPTURE_TYPE_TELEMETRY,						/**< The data of a telemetry packet received by the transmitter */
+};
+
+/* The capture packet flags */
+#define CAPTURE_FLAG_ERROR			(1<<0)		/**< The CYRF6936 signalled a receive error */
+#define CAPTURE_FLAG_CRC_INVERTED	(1<<1)		/**< The packet was received with the inverted CRC seed */
+#define CAPTURE_FLAG_TELEMETRY		(1<<2)		/**< The pcapng block carries telemetry data from the tunnel instead of a radio packet */
+
+/**
+ * The header in front of every capture record
+ */
+struct CaptureHeader {
+	uint8_t sync;								/**< Always CAPTURE_SYNC */
+	uint8_t type;								/**< The record type (enum capture_type) */
+	uint8_t length;								/**< The length of the record after the header */
+} __attribute__((packed));
+
+/**
+ * A captured radio packet, this is also the pcapng link-layer header (little endian)
+ */
+struct CapturePacket {
+	uint32_t timestamp;							/**< The receive time in microseconds since boot */
+	uint8_t channel;							/**< The RF channel */
+	uint8_t sop_col;							/**< The SOP column */
+	uint8_t flags;								/**< The capture flags */
+	uint8_t rssi;								/**< The RSSI register */
+	uint8_t rx_status;							/**< The RX status register */
+	uint8_t data[CAPTURE_MAX_DATA];				/**< The packet data (only the received length is send) */
+} __attribute__((packed));
+#define CAPTURE_PACKET_HEADER		9			/**< The size of a CapturePacket without the data */
+
+/**
+ * The capture statistics, send every CAPTURE_STATS_INTERVAL
+ */
+struct CaptureStats {
+	uint32_t timestamp;							/**< The time in microseconds since boot */
+	uint32_t captured;							/**< The total captured packets */
+	uint32_t dropped;							/**< The total dropped packets because the USB was full */
+	uint32_t usb_packets;						/**< The total USB packets send */
+	uint16_t capture_rate;						/**< The captured packets in the last interval */
+	uint16_t usb_rate;							/**< The USB packets send in the last interval */
+} __attribute__((packed));
+
+/* External functions */
+bool capture_send(enum capture_type type, const void *data, uint8_t length);
+void capture_packet(uint8_t channel, uint8_t sop_col, bool crc_inverted, uint8_t *data, uint8_t length, uint8_t rssi, uint8_t rx_status, bool error);
+void capture_telemetry(const uint8_t *data, uint8_t length);
+void capture_run(void);
+
+#endif /* MODULES_CAPTURE_H_ */
@@ -18,34 +18,62 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <libopencm3/cm3/common.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/usb/cdc.h>
+#include <libopencm3/usb/hid.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/stm32/f1/nvic.h>
 
+#include "timer.h"
+#include "sched.h"
 #include "cdcacm.h"
 
 // The recieve callback
 cdcacm_receive_callback _cdcacm_receive_callback = NULL;
+// The console callback, used instead when the host selects the console baudrate
+cdcacm_receive_callback _cdcacm_console_callback = NULL;
+// The HID channels report callback
+static cdcacm_channels_callback _cdcacm_channels_callback = NULL;
+static bool cdcacm_console = false;
 // The usbd device
 usbd_device *cdacm_usbd_dev = NULL;
 // The usbd control buffer
 uint8_t cdacm_usbd_control_buffer[128];
 bool cdcacm_did_receive = false;
 
+// The transmit ring, filled from everywhere and emptied in full packets by the USB callbacks
+static struct Buffer cdcacm_tx_buffer;
+static uint8_t cdcacm_tx_packet[64];
+static volatile bool cdcacm_tx_busy = false;
+static bool cdcacm_configured = false;
+uint32_t cdcacm_tx_packets = 0;
+uint32_t cdcacm_tx_dropped = 0;
+uint8_t cdcacm_opened = 0;
+
+// The HID gamepad reports, the receiver fills one while the other one is send
+static struct HidReport cdcacm_hid_reports[2];
+static volatile uint8_t cdcacm_hid_report_idx = 0;
+static volatile uint16_t cdcacm_hid_report_ticks = 0;
+static volatile bool cdcacm_hid_report_new = false;
+static bool cdcacm_hid_configured = false;
+uint16_t cdcacm_hid_latency_max = 0;
+
 // The usb device descriptor
 static const struct usb_device_descriptor dev = {
 	.bLength = USB_DT_DEVICE_SIZE,
 	.bDescriptorType = USB_DT_DEVICE,
 	.bcdUSB = 0x0200,
-	.bDeviceClass = USB_CLASS_CDC,
-	.bDeviceSubClass = 0,
-	.bDeviceProtocol = 0,
+	.bDeviceClass = 0xEF,								// Miscellaneous device with an IAD
+	.bDeviceSubClass = 0x02,
+	.bDeviceProtocol = 0x01,
 	.bMaxPacketSize0 = 64,
 	.idVendor = 0x0484,
 	.idProduct = 0x5741,
-	.bcdDevice = 0x0200,
+	.bcdDevice = 0x0300,								// Bumped for the composite device, so Windows reads the new descriptors
 	.iManufacturer = 1,
 	.iProduct = 2,
 	.iSerialNumber = 3,
@@ -148,13 +176,132 @@ static const struct usb_interface_descriptor data_iface[] = {{
 	.endpoint = data_endp,
 }};
 
+// The CDC interface association, so the host groups the comm and data interfaces
+static const struct usb_iface_assoc_descriptor cdcacm_assoc = {
+	.bLength = USB_DT_INTERFACE_ASSOCIATION_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE_ASSOCIATION,
+	.bFirstInterface = 0,
+	.bInterfaceCount = 2,
+	.bFunctionClass = USB_CLASS_CDC,
+	.bFunctionSubClass = USB_CDC_SUBCLASS_ACM,
+	.bFunctionProtocol = USB_CDC_PROTOCOL_AT,
+	.iFunction = 0,
+};
+
+// The HID gamepad report descriptor (must match struct HidReport)
+static const uint8_t hid_report_descriptor[] = {
+	0x05, 0x01,							// Usage Page (Generic Desktop)
+	0x09, 0x05,							// Usage (Game Pad)
+	0xA1, 0x01,							// Collection (Application)
+	0x09, 0x30, 0x09, 0x31,				//   Usage (X), Usage (Y)
+	0x09, 0x32, 0x09, 0x33,				//   Usage (Z), Usage (Rx)
+	0x09, 0x34, 0x09, 0x35,				//   Usage (Ry), Usage (Rz)
+	0x09, 0x36, 0x09, 0x37,				//   Usage (Slider), Usage (Dial)
+	0x16, 0x20, 0x03,					//   Logical Minimum (800)
+	0x26, 0x98, 0x08,					//   Logical Maximum (2200)
+	0x75, 0x10,							//   Report Size (16)
+	0x95, CDCACM_HID_AXES,				//   Report Count (8)
+	0x81, 0x02,							//   Input (Data, Variable, Absolute)
+	0x05, 0x09,							//   Usage Page (Button)
+	0x19, 0x01,							//   Usage Minimum (1)
+	0x29, CDCACM_HID_BUTTONS,			//   Usage Maximum (6)
+	0x15, 0x00,							//   Logical Minimum (0)
+	0x25, 0x01,							//   Logical Maximum (1)
+	0x75, 0x01,							//   Report Size (1)
+	0x95, CDCACM_HID_BUTTONS,			//   Report Count (6)
+	0x81, 0x02,							//   Input (Data, Variable, Absolute)
+	0x75, 8 - CDCACM_HID_BUTTONS,		//   Report Size (2)
+	0x95, 0x01,							//   Report Count (1)
+	0x81, 0x03,							//   Input (Constant) padding
+	0x06, 0x00, 0xFF,					//   Usage Page (Vendor defined)
+	0x09, 0x01,							//   Usage (Latency)
+	0x15, 0x00,							//   Logical Minimum (0)
+	0x27, 0xFF, 0xFF, 0x00, 0x00,		//   Logical Maximum (65535)
+	0x75, 0x10,							//   Report Size (16)
+	0x95, 0x01,							//   Report Count (1)
+	0x81, 0x02,							//   Input (Data, Variable, Absolute)
+	0x09, 0x02,							//   Usage (Channel count)
+	0x15, 0x00,							//   Logical Minimum (0)
+	0x25, CONVERT_MAX_CHANNELS,			//   Logical Maximum (14)
+	0x75, 0x08,							//   Report Size (8)
+	0x95, 0x01,							//   Report Count (1)
+	0x91, 0x02,							//   Output (Data, Variable, Absolute)
+	0x09, 0x03,							//   Usage (Channels)
+	0x16, 0x18, 0xFC,					//   Logical Minimum (-1000)
+	0x26, 0xE8, 0x03,					//   Logical Maximum (1000)
+	0x75, 0x10,							//   Report Size (16)
+	0x95, CONVERT_MAX_CHANNELS,			//   Report Count (14)
+	0x91, 0x02,							//   Output (Data, Variable, Absolute)
+	0xC0								// End Collection
+};
+
+// The HID function descriptor
+static const struct {
+	struct usb_hid_descriptor hid_descriptor;
+	struct {
+		uint8_t bReportDescriptorType;
+		uint16_t wDescriptorLength;
+	} __attribute__((packed)) hid_report;
+} __attribute__((packed)) hid_function = {
+	.hid_descriptor = {
+		.bLength = sizeof(hid_function),
+		.bDescriptorType = USB_DT_HID,
+		.bcdHID = 0x0111,
+		.bCountryCode = 0,
+		.bNumDescriptors = 1,
+	},
+	.hid_report = {
+		.bReportDescriptorType = USB_DT_REPORT,
+		.wDescriptorLength = sizeof(hid_report_descriptor),
+	},
+};
+
+// The HID endpoint descriptors, polled every frame
+static const struct usb_endpoint_descriptor hid_endp[] = {{
+	.bLength = USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType = USB_DT_ENDPOINT,
+	.bEndpointAddress = CDCACM_HID_EP,
+	.bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
+	.wMaxPacketSize = 32,
+	.bInterval = 1,
+}, {
+	.bLength = USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType = USB_DT_ENDPOINT,
+	.bEndpointAddress = CDCACM_HID_OUT_EP,
+	.bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
+	.wMaxPacketSize = 32,
+	.bInterval = 1,
+}};
+
+// The HID interface descriptor
+static const struct usb_interface_descriptor hid_iface[] = {{
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bInterfaceNumber = CDCACM_HID_IFACE,
+	.bAlternateSetting = 0,
+	.bNumEndpoints = 2,
+	.bInterfaceClass = USB_CLASS_HID,
+	.bInterfaceSubClass = 0,
+	.bInterfaceProtocol = 0,
+	.iInterface = 0,
+
+	.endpoint = hid_endp,
+
+	.extra = &hid_function,
+	.extralen = sizeof(hid_function),
+}};
+
 // The usb interfaces
 static const struct usb_interface ifaces[] = {{
 	.num_altsetting = 1,
+	.iface_assoc = &cdcacm_assoc,
 	.altsetting = comm_iface,
 }, {
 	.num_altsetting = 1,
 	.altsetting = data_iface,
+}, {
+	.num_altsetting = 1,
+	.altsetting = hid_iface,
 }};
 
 // The usb config descriptor
@@ -162,7 +309,7 @@ static const struct usb_config_descriptor config = {
 	.bLength = USB_DT_CONFIGURATION_SIZE,
 	.bDescriptorType = USB_DT_CONFIGURATION,
 	.wTotalLength = 0,
-	.bNumInterfaces = 2,
+	.bNumInterfaces = 3,
 	.bConfigurationValue = 1,
 	.iConfiguration = 0,
 	.bmAttributes = 0x80,
@@ -185,9 +332,12 @@ static int cdcacm_control_request(usbd_device *usbd_dev,
 		struct usb_setup_data *req, uint8_t **buf, uint16_t *len,
 		void (**complete)(usbd_device *usbd_dev, struct usb_setup_data *req)) {
 	(void) complete;
-	(void) buf;
 	(void) usbd_dev;
 
+	// The HID interface only needs SET_IDLE to be accepted
+	if (req->wIndex == CDCACM_HID_IFACE)
+		return (req->bRequest == CDCACM_HID_SET_IDLE);
+
 	switch (req->bRequest) {
 	case USB_CDC_REQ_SET_CONTROL_LINE_STATE: {
 		/*
@@ -195,16 +345,140 @@ static int cdcacm_control_request(usbd_device *usbd_dev,
 		 * even though it's optional in the CDC spec, and we don't
 		 * advertise it in the ACM functional descriptor.
 		 */
+		// When the host opens the port (DTR set), drop the output it never read
+		if (req->wValue & 0x01) {
+			uint32_t mask = cm_mask_interrupts(1);
+			convert_init(&cdcacm_tx_buffer);
+			cm_mask_interrupts(mask);
+			cdcacm_opened++;
+		}
 		return 1;
 	}
 	case USB_CDC_REQ_SET_LINE_CODING:
 		if (*len < sizeof(struct usb_cdc_line_coding))
 			return 0;
+
+		// The console baudrate switches the port to the console
+		cdcacm_console = (((struct usb_cdc_line_coding *)*buf)->dwDTERate == CDCACM_CONSOLE_BAUDRATE);
 		return 1;
 	}
 	return 0;
 }
 
+/**
+ * HID standard request received (for the report descriptor)
+ */
+static int cdcacm_hid_control_request(usbd_device *usbd_dev,
+		struct usb_setup_data *req, uint8_t **buf, uint16_t *len,
+		void (**complete)(usbd_device *usbd_dev, struct usb_setup_data *req)) {
+	(void) complete;
+	(void) usbd_dev;
+
+	if (req->bmRequestType != (USB_REQ_TYPE_IN | USB_REQ_TYPE_INTERFACE)
+			|| req->bRequest != USB_REQ_GET_DESCRIPTOR
+			|| req->wValue != (USB_DT_REPORT << 8)
+			|| req->wIndex != CDCACM_HID_IFACE)
+		return 0;
+
+	*buf = (uint8_t *)hid_report_descriptor;
+	*len = sizeof(hid_report_descriptor);
+	return 1;
+}
+
+/**
+ * HID report send callback, directly loads the newest report for the next poll
+ */
+static void cdcacm_hid_tx_cb(usbd_device *usbd_dev, uint8_t ep) {
+	struct HidReport report;
+	uint16_t latency;
+	(void) ep;
+
+	// Copy the newest report, the receiver only writes the other one
+	report = cdcacm_hid_reports[cdcacm_hid_report_idx];
+
+	// Measure the time between the packet decoding and loading the endpoint
+	if (cdcacm_hid_report_new) {
+		cdcacm_hid_report_new = false;
+		latency = timer_get_ticks() - cdcacm_hid_report_ticks;
+		if (latency > cdcacm_hid_latency_max)
+			cdcacm_hid_latency_max = latency;
+		report.latency = latency;
+	}
+
+	usbd_ep_write_packet(usbd_dev, CDCACM_HID_EP, &report, sizeof(report));
+}
+
+/**
+ * HID channels report receive callback, passes the channels to the protocol
+ */
+static void cdcacm_hid_rx_cb(usbd_device *usbd_dev, uint8_t ep) {
+	struct HidChannelsReport report;
+	int16_t channels[CONVERT_MAX_CHANNELS];
+	int len;
+	uint8_t i;
+	(void) ep;
+
+	len = usbd_ep_read_packet(usbd_dev, CDCACM_HID_OUT_EP, &report, sizeof(report));
+	if (len < 1 || report.count > CONVERT_MAX_CHANNELS || len < 1 + 2 * report.count)
+		return;
+
+	// Copy the channels out of the packed report and keep them in range
+	memcpy(channels, report.channels, report.count * sizeof(int16_t));
+	for (i = 0; i < report.count; i++) {
+		if (channels[i] < -CONVERT_NORM_MAX)
+			channels[i] = -CONVERT_NORM_MAX;
+		else if (channels[i] > CONVERT_NORM_MAX)
+			channels[i] = CONVERT_NORM_MAX;
+	}
+
+	if (_cdcacm_channels_callback != NULL && report.count > 0)
+		_cdcacm_channels_callback(channels, report.count);
+}
+
+/**
+ * Load the next packet from the transmit ring into the data endpoint
+ * @param[in] partial Whether a packet smaller then 64 bytes may be send
+ */
+static void cdcacm_tx_load(bool partial) {
+	uint16_t length;
+	uint32_t mask;
+
+	if (!cdcacm_configured || cdcacm_tx_busy)
+		return;
+
+	// Only send full packets, unless we need to flush
+	mask = cm_mask_interrupts(1);
+	length = convert_extract_size(&cdcacm_tx_buffer);
+	if (length == 0 || (length < 64 && !partial)) {
+		cm_mask_interrupts(mask);
+		return;
+	}
+	length = convert_extract(&cdcacm_tx_buffer, cdcacm_tx_packet, 64);
+	cm_mask_interrupts(mask);
+
+	cdcacm_tx_busy = true;
+	cdcacm_tx_packets++;
+	usbd_ep_write_packet(cdacm_usbd_dev, 0x82, cdcacm_tx_packet, length);
+}
+
+/**
+ * CDCACM transmit callback, directly reloads the endpoint with the next packet
+ */
+static void cdcacm_data_tx_cb(usbd_device *usbd_dev, uint8_t ep) {
+	(void) ep;
+	(void) usbd_dev;
+
+	cdcacm_tx_busy = false;
+	cdcacm_tx_load(false);
+}
+
+/**
+ * CDCACM start of frame callback, flushes partial packets every millisecond
+ */
+static void cdcacm_sof_cb(void) {
+	cdcacm_tx_load(true);
+}
+
 /**
  * CDCACM recieve callback
  */
@@ -212,14 +486,17 @@ static void cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep) {
 	(void) ep;
 	(void) usbd_dev;
 
-	char buf[64];
+	char buf[64 + 1];
 	int len = usbd_ep_read_packet(usbd_dev, 0x01, buf, 64);
 	cdcacm_did_receive = true;
 
 	if (len) {
 		buf[len] = 0;
 
-		if (_cdcacm_receive_callback != NULL) {
+		if (cdcacm_console) {
+			if (_cdcacm_console_callback != NULL)
+				_cdcacm_console_callback(buf, len);
+		} else if (_cdcacm_receive_callback != NULL) {
 			_cdcacm_receive_callback(buf, len);
 		}
 	}
@@ -234,12 +511,26 @@ static void cdcacm_set_config_callback(usbd_device *usbd_dev, uint16_t wValue) {
 
 	usbd_ep_setup(usbd_dev, 0x01, USB_ENDPOINT_ATTR_BULK, 64,
 			cdcacm_data_rx_cb);
-	usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK, 64, NULL);
+	usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK, 64,
+			cdcacm_data_tx_cb);
 	usbd_ep_setup(usbd_dev, 0x83, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
+	usbd_ep_setup(usbd_dev, CDCACM_HID_EP, USB_ENDPOINT_ATTR_INTERRUPT, 32,
+			cdcacm_hid_tx_cb);
+	usbd_ep_setup(usbd_dev, CDCACM_HID_OUT_EP, USB_ENDPOINT_ATTR_INTERRUPT, 32,
+			cdcacm_hid_rx_cb);
 
 	usbd_register_control_callback(usbd_dev,
 			USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
 			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT, cdcacm_control_request);
+	usbd_register_control_callback(usbd_dev,
+			USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_INTERFACE,
+			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT, cdcacm_hid_control_request);
+
+	// Start the transmit and HID report stream, they keep running from the send callbacks
+	cdcacm_configured = true;
+	cdcacm_tx_busy = false;
+	cdcacm_hid_configured = true;
+	cdcacm_hid_tx_cb(usbd_dev, CDCACM_HID_EP);
 }
 
 /**
@@ -261,6 +552,8 @@ void cdcacm_init(void) {
 			sizeof(cdacm_usbd_control_buffer));
 	usbd_register_set_config_callback(cdacm_usbd_dev,
 			cdcacm_set_config_callback);
+	usbd_register_sof_callback(cdacm_usbd_dev, cdcacm_sof_cb);
+	convert_init(&cdcacm_tx_buffer);
 
 	/**
 	 * Setup GPIOA Detach pin to pull up the D+ high. To let the host know that we are here and ready to talk.
@@ -268,6 +561,53 @@ void cdcacm_init(void) {
 	gpio_set(USB_DETACH_PORT, USB_DETACH_PIN);
 	gpio_set_mode(USB_DETACH_PORT, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL,
 			USB_DETACH_PIN);
+
+	// Handle the USB from the scheduler when an USB interrupt occurs
+	nvic_set_priority(NVIC_USB_LP_CAN_RX0_IRQ, 0xF0);
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+}
+
+/**
+ * The USB interrupt, masks itself and lets the USB task do the work
+ */
+void usb_lp_can_rx0_isr(void) {
+	nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	sched_event(SCHED_TASK_USB);
+}
+
+/**
+ * Update the HID gamepad report with a new channel frame
+ * This is called from the receiver interrupt, the report is send at the next USB poll
+ * @param[in] frame The decoded channel frame
+ */
+void cdcacm_hid_update(const struct ChannelFrame *frame) {
+	uint8_t idx = !cdcacm_hid_report_idx;
+	struct HidReport *report = &cdcacm_hid_reports[idx];
+	uint8_t i;
+
+	if (!cdcacm_hid_configured)
+		return;
+
+	// Fill the axes, unknown channels are centered
+	for (i = 0; i < CDCACM_HID_AXES; i++) {
+		if (i < frame->nb_channels && frame->us[i] != 0)
+			report->axes[i] = frame->us[i];
+		else
+			report->axes[i] = 1500;
+	}
+
+	// The remaining channels are buttons which are pressed above center
+	report->buttons = 0;
+	for (i = 0; i < CDCACM_HID_BUTTONS; i++) {
+		if (CDCACM_HID_AXES + i < frame->nb_channels && frame->us[CDCACM_HID_AXES + i] > 1500)
+			report->buttons |= (1 << i);
+	}
+	report->latency = 0;
+
+	// Swap the reports
+	cdcacm_hid_report_ticks = timer_get_ticks();
+	cdcacm_hid_report_idx = idx;
+	cdcacm_hid_report_new = true;
 }
 
 /**
@@ -275,6 +615,8 @@ void cdcacm_init(void) {
  */
 void cdcacm_run(void) {
 	usbd_poll(cdacm_usbd_dev);
+	cdcacm_tx_load(false);
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
 }
 
 /**
@@ -285,23 +627,41 @@ void cdcacm_register_receive_callback(cdcacm_receive_callback callback) {
 	_cdcacm_receive_callback = callback;
 }
 
+/**
+ * Register CDCACM console callback
+ * @param[in] callback The function for the receive callback in console mode
+ */
+void cdcacm_register_console_callback(cdcacm_receive_callback callback) {
+	_cdcacm_console_callback = callback;
+}
+
+/**
+ * Register the HID channels report callback
+ * @param[in] callback The function called with the channels the host sends
+ */
+void cdcacm_register_channels_callback(cdcacm_channels_callback callback) {
+	_cdcacm_channels_callback = callback;
+}
+
 /**
  * Send data trough the CDCACM
+ * The data is queued and send in full packets, this never blocks and can be called from interrupts
  * @param[in] data The data that needs to be send
  * @param[in] size The size of the data in bytes
+ * @return False when the data was dropped because the transmit ring is full
  */
 bool cdcacm_send(const char *data, const int size) {
-	int i = 0;
+	uint32_t mask;
+	bool ret;
 
 	if(size == 0)
 		return true;
 
-	while ((size - (i * 64)) > 64) {
-		while (usbd_ep_write_packet(cdacm_usbd_dev, 0x82, (data + (i * 64)), 64) == 0);
-		i++;
-	}
-
-	while (usbd_ep_write_packet(cdacm_usbd_dev, 0x82, (data + (i * 64)), size - (i * 64)) == 0);
+	mask = cm_mask_interrupts(1);
+	ret = convert_insert(&cdcacm_tx_buffer, (uint8_t *)data, size);
+	if(!ret)
+		cdcacm_tx_dropped++;
+	cm_mask_interrupts(mask);
 
-	return true;
+	return ret;
 }
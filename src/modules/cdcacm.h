@@ -22,13 +22,49 @@
 
 // Include the board specifications for the USB define
 #include "../board.h"
+#include "../helper/convert.h"
+
+/* The HID gamepad */
+#define CDCACM_HID_IFACE		2			/**< The HID interface number */
+#define CDCACM_HID_EP			0x84		/**< The HID interrupt IN endpoint */
+#define CDCACM_HID_OUT_EP		0x04		/**< The HID interrupt OUT endpoint for the channels report */
+#define CDCACM_HID_AXES			8			/**< The channels reported as axes */
+#define CDCACM_HID_BUTTONS		6			/**< The channels reported as buttons */
+#define CDCACM_HID_SET_IDLE		0x0A		/**< The HID class SET_IDLE request */
+
+#define CDCACM_CONSOLE_BAUDRATE	1200		/**< Selecting this baudrate on the host enters the console */
+
+/**
+ * The HID gamepad report
+ */
+struct HidReport {
+	uint16_t axes[CDCACM_HID_AXES];			/**< The first channels in microseconds */
+	uint8_t buttons;						/**< The remaining channels as buttons */
+	uint16_t latency;						/**< Packet decode to endpoint load in 10 microseconds */
+} __attribute__((packed));
+
+/**
+ * The HID channels output report, the host sets the transmitter sticks with it next to the data tunnel
+ */
+struct HidChannelsReport {
+	uint8_t count;							/**< The amount of channels */
+	int16_t channels[CONVERT_MAX_CHANNELS];	/**< The channels from -1000 to 1000 */
+} __attribute__((packed));
 
 typedef void (*cdcacm_receive_callback) (char *data, int size);
+typedef void (*cdcacm_channels_callback) (int16_t *channels, uint8_t count);
 extern bool cdcacm_did_receive;
+extern uint16_t cdcacm_hid_latency_max;
+extern uint32_t cdcacm_tx_packets;
+extern uint32_t cdcacm_tx_dropped;
+extern uint8_t cdcacm_opened;
 
 void cdcacm_init(void);
 void cdcacm_run(void);
 void cdcacm_register_receive_callback(cdcacm_receive_callback callback);
+void cdcacm_register_console_callback(cdcacm_receive_callback callback);
+void cdcacm_register_channels_callback(cdcacm_channels_callback callback);
 bool cdcacm_send(const char *data, const int size);
+void cdcacm_hid_update(const struct ChannelFrame *frame);
 
 #endif /* MODULES_CDCACM_H_ */
@@ -20,26 +20,84 @@
 
 #include "config.h"
 #include "../helper/dsm.h"
+#include "../helper/crc.h"
+#include "cyrf6936.h"
+#include "led.h"
+#include "button.h"
+#include "timer.h"
+#include "cdcacm.h"
 #include <libopencm3/stm32/flash.h>
+#include <libopencm3/cm3/cortex.h>
 
 struct Config usbrf_config;
 char debug_msg[512];
 
-void (*protocol_functions[][3])(void) = {
+void (*protocol_functions[PROTOCOL_NB][3])(void) = {
 	{dsm_receiver_init, dsm_receiver_start, dsm_receiver_stop},
 	{dsm_transmitter_init, dsm_transmitter_start, dsm_transmitter_stop},
 	{dsm_mitm_init, dsm_mitm_start, dsm_mitm_stop},
 };
 
+/**
+ * The shared part of the protocol stop functions, called after the DSM timer is stopped
+ */
+void protocol_stop_common(void) {
+	// Abort the transfer and idle the radio
+	cyrf_write_register(CYRF_XACT_CFG, CYRF_MODE_IDLE | CYRF_FRC_END);
+	cyrf_write_register(CYRF_RX_ABORT, 0x00);
+
+	// Remove the callbacks
+	timer_dsm_register_callback(NULL);
+	cyrf_register_recv_callback(NULL);
+	cyrf_register_send_callback(NULL);
+	button_bind_register_callback(NULL);
+	cdcacm_register_receive_callback(NULL);
+	cdcacm_register_channels_callback(NULL);
+
+	// Set the leds off
+#ifdef LED_BIND
+	LED_OFF(LED_BIND);
+#endif
+#ifdef LED_RX
+	LED_OFF(LED_RX);
+#endif
+#ifdef LED_TX
+	LED_OFF(LED_TX);
+#endif
+}
+
 /* We are assuming we are using the STM32F103TBU6.
  * Flash: 128 * 1kb pages
- * We want to store the config in the last flash sector.
+ * We store the config as a log of records in the last two flash pages. A new
+ * record is appended to the page with the newest record, and when that page is
+ * full the other page is erased and the log continues there.
+ */
+#define CONFIG_PAGE_SIZE		1024
+#define CONFIG_RECORD_MAGIC		0xC0F6
+#define CONFIG_RECORD_FREE		0xFFFF
+static const uint32_t config_pages[2] = {0x0801F800, 0x0801FC00};
+
+/**
+ * The header of a config record in flash, followed by the config and a CRC16
  */
-#define CONFIG_ADDR 0x0801FC00
+struct ConfigRecord {
+	uint16_t magic;						/**< Always CONFIG_RECORD_MAGIC (erased flash is free space) */
+	uint16_t length;					/**< The length of the config after the header */
+	uint32_t sequence;					/**< The record number, the newest valid record is loaded */
+} __attribute__((packed));
+#define CONFIG_RECORD_SIZE(length) ((sizeof(struct ConfigRecord) + (length) + 2 + 3) & ~3)
+
+/* The config log state */
+static uint32_t config_record_addr = 0;		/**< The address of the newest valid record (0 when none) */
+static uint32_t config_free_addr = 0;		/**< The free space after the newest record (0 when full) */
+static uint32_t config_sequence = 0;		/**< The sequence number of the newest record */
+static volatile bool config_store_pending = false;
+bool config_store_failed = false;
+struct BootTimeline boot_timeline = {0, 0, 0, 0, 0};
 
 /* Default configuration settings. */
 const struct Config init_config = {
-			.version				= 0x01,
+			.version				= 0x0B,
 			.protocol				= DSM_MITM,
 			.protocol_start 			= true,
 			.debug_enable 				= false,
@@ -47,7 +105,13 @@ const struct Config init_config = {
 			.debug_cyrf6936				= false,
 			.debug_dsm				= false,
 			.debug_protocol				= true,
+			.debug_sched				= false,
 			.timer_scaler				= 1,
+			.cyrf_spi_div				= 0,
+			.capture_enable				= false,
+			.capture_format				= CAPTURE_FORMAT_RECORD,
+			.servo_ppm_enable			= false,
+			.servo_serial				= SERVO_SERIAL_NONE,
 			.dsm_start_bind				= false,
 			.dsm_max_channel			= DSM_MAX_CHANNEL,
 			.dsm_bind_channel			= -1,
@@ -56,20 +120,131 @@ const struct Config init_config = {
 			.dsm_num_channels			= 6,
 			.dsm_force_dsm2				= false,
 			.dsm_max_missed_packets 		= 3,
+			.dsm_failsafe_us			= {CONVERT_US_OFFSET},
 			.dsm_bind_packets			= DSM_BIND_PACKETS,
 			.dsm_mitm_both_data			= false,
 			.dsm_mitm_has_uplink			= true,
+			.dsm_tx_power				= CYRF_PA_4,
+			.dsm_tx_power_auto			= false,
+			.dsm_tx_power_rssi			= DSM_TX_POWER_RSSI,
+			.dsm_survey					= true,
+			.dsm_tx_deadline			= DSM_TX_DEADLINE,
+			.dsm_soft_crc				= false,
 };
 
+/**
+ * Calculate the CRC of a config record
+ * @param[in] record The record in flash
+ * @return The CRC16 over the length, sequence and config
+ */
+static uint16_t config_record_crc(const struct ConfigRecord *record) {
+	uint16_t crc = crc16_ccitt(0xFFFF, (const uint8_t *)&record->length, 6);
+	return crc16_ccitt(crc, (const uint8_t *)record + sizeof(struct ConfigRecord), record->length);
+}
+
+/**
+ * Check whether a config record is valid
+ * @param[in] record The record in flash
+ */
+static bool config_record_valid(const struct ConfigRecord *record) {
+	const uint8_t *crc = (const uint8_t *)record + sizeof(struct ConfigRecord) + record->length;
+	return config_record_crc(record) == (crc[0] | (crc[1] << 8));
+}
+
+/**
+ * Scan the config pages for the newest valid record and the free space after it
+ */
+static void config_scan(void) {
+	const struct ConfigRecord *record;
+	uint32_t addr, end;
+	bool newest;
+	int i;
+
+	config_record_addr = 0;
+	config_free_addr = 0;
+	config_sequence = 0;
+
+	for (i = 0; i < 2; i++) {
+		addr = config_pages[i];
+		end = addr + CONFIG_PAGE_SIZE;
+		newest = false;
+
+		// Walk trough the records until the free space or a broken record
+		while (addr + sizeof(struct ConfigRecord) <= end) {
+			record = (const struct ConfigRecord *)addr;
+			if (record->magic != CONFIG_RECORD_MAGIC || addr + CONFIG_RECORD_SIZE(record->length) > end)
+				break;
+
+			if ((config_record_addr == 0 || record->sequence > config_sequence) && config_record_valid(record)) {
+				config_record_addr = addr;
+				config_sequence = record->sequence;
+				newest = true;
+			}
+			addr += CONFIG_RECORD_SIZE(record->length);
+		}
+
+		// Only continue after the newest record when the page isn't full or broken
+		if (newest)
+			config_free_addr = (addr < end && *(uint16_t *)addr == CONFIG_RECORD_FREE)? addr : 0;
+	}
+}
+
+/**
+ * Append a config record to the log
+ * @param[in] config The config to write
+ * @return False when the written record doesn't verify
+ */
+static bool config_write(const struct Config *config) {
+	uint16_t record[CONFIG_RECORD_SIZE(sizeof(struct Config)) / 2];
+	struct ConfigRecord *header = (struct ConfigRecord *)record;
+	uint8_t *data = (uint8_t *)record + sizeof(struct ConfigRecord);
+	uint32_t addr = config_free_addr;
+	uint16_t crc;
+	uint16_t i;
+
+	// Don't wear the flash when nothing changed
+	if (config_record_addr != 0 && ((const struct ConfigRecord *)config_record_addr)->length == sizeof(struct Config)
+			&& memcmp((const uint8_t *)config_record_addr + sizeof(struct ConfigRecord), config, sizeof(struct Config)) == 0)
+		return true;
+
+	// Create the record
+	memset(record, 0xFF, sizeof(record));
+	header->magic = CONFIG_RECORD_MAGIC;
+	header->length = sizeof(struct Config);
+	header->sequence = config_sequence + 1;
+	memcpy(data, config, sizeof(struct Config));
+	crc = config_record_crc(header);
+	data[sizeof(struct Config)] = crc & 0xFF;
+	data[sizeof(struct Config) + 1] = crc >> 8;
+
+	flash_unlock();
+
+	// When the page is full continue in the other page, the old records stay as backup until then
+	if (addr == 0 || (addr % CONFIG_PAGE_SIZE) + sizeof(record) > CONFIG_PAGE_SIZE) {
+		addr = (config_record_addr >= config_pages[0] && config_record_addr < config_pages[1])? config_pages[1] : config_pages[0];
+		flash_erase_page(addr);
+	}
+
+	// Write the record, the magic first and the CRC last
+	for (i = 0; i < sizeof(record) / 2; i++) {
+		if (record[i] != 0xFFFF)
+			flash_program_half_word(addr + i*2, record[i]);
+	}
+
+	flash_lock();
+
+	// Check flash content for accuracy
+	config_scan();
+	return (config_record_addr == addr);
+}
+
 void config_init(void) {
 	struct Config loaded_config;
 
-	config_load(&loaded_config);
-
 	/* Check if the version stored in flash is the same as the one we have set
 	   by default. Otherwise the config is very likely outdated and we will have to
 	   discard it. */
-	if (loaded_config.version == init_config.version) {
+	if (config_load(&loaded_config) && loaded_config.version == init_config.version) {
 		memcpy(&usbrf_config, &loaded_config, sizeof(struct Config));
 	} else {
 		memcpy(&usbrf_config, &init_config, sizeof(init_config));
@@ -77,63 +252,47 @@ void config_init(void) {
 
 }
 
+/**
+ * Store the config in flash.
+ * This can be called from interrupts, the actual write is done in config_run()
+ * because erasing a page stalls the CPU for tens of milliseconds.
+ */
 void config_store(void) {
+	config_store_pending = true;
+	sched_event(SCHED_TASK_CONFIG);
+}
 
-	uint16_t size = sizeof(struct Config);
-	uint32_t addr = CONFIG_ADDR;
-	uint8_t  *byte_config = (uint8_t *)&usbrf_config;
-	uint16_t write_word;
-	int i;
-
-	/* Unlock flash. */
-	flash_unlock();
-
-	/* Erase the config storage page. */
-	flash_erase_page(CONFIG_ADDR);
-
-	/* Write config struct to flash. */
-	write_word = 0xFFFF;
-	for (i = 0; i < size; i++) {
-		write_word = (write_word << 8) | (*(byte_config++));
-		if ((i % 2) == 1) {
-			flash_program_half_word(addr, write_word);
-			addr += 2;
-		}
-	}
-
-	if ((i % 2) == 1) {
-		write_word = (write_word << 8) | 0xFF;
-		flash_program_half_word(addr, write_word);
-	}
-
-	/* Write config CRC to flash. */
+/**
+ * Write a pending config store, called from the config task
+ */
+void config_run(void) {
+	struct Config config;
+	uint32_t mask;
 
-	/* Lock flash. */
-	flash_lock();
+	if (!config_store_pending)
+		return;
+	config_store_pending = false;
 
-	/* Check flash content for accuracy. */
+	// Take a consistent copy of the config
+	mask = cm_mask_interrupts(1);
+	memcpy(&config, &usbrf_config, sizeof(struct Config));
+	cm_mask_interrupts(mask);
 
+	// A failed write leaves the previous record as the newest one
+	config_store_failed = !config_write(&config);
 }
 
 /**
- * Load the config from flash.
- * This is definitely not the most efficient way of reading out the data. But
- * as we do it only once it probably does not matter much. (esden)
+ * Load the newest valid config record from flash.
+ * @param[out] config The loaded config
+ * @return False when there is no valid config with the right length
  */
-void config_load(struct Config *config) {
-	uint16_t size = sizeof(struct Config);
-	uint16_t *flash_data = (uint16_t *)CONFIG_ADDR;
-	uint8_t *byte_config = (uint8_t *)config;
-	int i;
+bool config_load(struct Config *config) {
+	config_scan();
 
-	for (i = 0; i < size; i++) {
-		if ((i % 2) == 0) {
-			*byte_config = (*flash_data) >> 8;
-			byte_config++;
-		} else {
-			*byte_config = (*flash_data) & 0xFF;
-			byte_config++;
-			flash_data++;
-		}
-	}
+	if (config_record_addr == 0 || ((const struct ConfigRecord *)config_record_addr)->length != sizeof(struct Config))
+		return false;
+
+	memcpy(config, (const uint8_t *)config_record_addr + sizeof(struct ConfigRecord), sizeof(struct Config));
+	return true;
 }
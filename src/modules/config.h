@@ -33,6 +33,9 @@
  * Includes for debugging
  */
 #include "cdcacm.h"
+#include "servo.h"
+#include "capture.h"
+#include "sched.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -58,6 +61,7 @@ enum Protocol {
 	DSM_HIJACK,
 	TUDELFT_DELFY
 };
+#define PROTOCOL_NB 3					/**< The amount of protocols with functions (receiver, transmitter and mitm) */
 
 /**
  * The init and start, stop functions of the protocols
@@ -65,7 +69,8 @@ enum Protocol {
 #define PROTOCOL_INIT 0
 #define PROTOCOL_START 1
 #define PROTOCOL_STOP 2
-extern void (*protocol_functions[][3])(void);
+extern void (*protocol_functions[PROTOCOL_NB][3])(void);
+void protocol_stop_common(void);
 
 struct Config {
 	uint32_t version;					/**< The static version number of the config */
@@ -77,8 +82,15 @@ struct Config {
 	bool debug_cyrf6936;				/**< When debugging the CYRF6936 module is enabled */
 	bool debug_dsm;						/**< When debugging the DSM helper is enabled */
 	bool debug_protocol;				/**< When debugging the protocol is enabled */
+	bool debug_sched;					/**< When the scheduler report is enabled */
 
 	uint32_t timer_scaler;				/**< The timer scaler for debugging */
+	uint16_t cyrf_spi_div;				/**< The SPI clock divider of the CYRF (0 probes the fastest reliable one up to the board maximum) */
+	bool capture_enable;				/**< Stream binary capture records of received packets (disable debug) */
+	enum capture_format capture_format;	/**< The capture output format (records or pcapng) */
+
+	bool servo_ppm_enable;				/**< When the PPM servo output is enabled */
+	enum servo_serial servo_serial;		/**< The serial servo output protocol (SBUS/SRXL) */
 
 	/* DSM protocol specific */
 	bool dsm_start_bind;				/**< Start with binding at boot */
@@ -89,17 +101,38 @@ struct Config {
 	uint8_t dsm_num_channels;			/**< The number of command channels */
 	bool dsm_force_dsm2;				/**< Force the use of DSM2 instead of DSMX */
 	uint8_t dsm_max_missed_packets;		/**< The maximum amount of missed packets since last receive */
+	uint16_t dsm_failsafe_us[CONVERT_MAX_CHANNELS];	/**< The failsafe value in microseconds per channel (0 holds the last value) */
 	uint16_t dsm_bind_packets;			/**< The amount of bind packets to send */
 	bool dsm_mitm_both_data;			/**< Whether we receive data on both channel A->B and B->A or only B->A */
 	bool dsm_mitm_has_uplink;			/**< Whether the MITM has the uplink enabled */
+	uint8_t dsm_tx_power;				/**< The transmit power (CYRF_PA_*), the maximum when automatic */
+	bool dsm_tx_power_auto;				/**< Lower the transmit power while the telemetry shows a good link */
+	uint8_t dsm_tx_power_rssi;			/**< The telemetry RSSI the automatic power control keeps the link above */
+	bool dsm_survey;					/**< Survey the noise at start to select the DSM2 and bind channels */
+	uint8_t dsm_tx_deadline;			/**< The maximum time in ms host data waits for a full packet before a partial one is send */
+	bool dsm_soft_crc;					/**< The receiver checks the CRC in software against both seeds instead of setting the seed every hop (experimental, the CRC coverage is not verified on hardware) */
 };
 extern struct Config usbrf_config;
+extern bool config_store_failed;
+
+/**
+ * The boot timeline, the times since boot in 10 microseconds (0 when it didn't happen yet)
+ */
+struct BootTimeline {
+	uint32_t radio_reset;				/**< The radio was released from reset */
+	uint32_t radio_ready;				/**< The radio responds and the crystal is stable */
+	uint32_t protocol_start;			/**< The protocol was initialized and started */
+	uint32_t first_send;				/**< The first packet was send */
+	uint32_t first_recv;				/**< The first packet was received without errors */
+};
+extern struct BootTimeline boot_timeline;
 
 /**
  * External functions
  */
 void config_init(void);
 void config_store(void);
-void config_load(struct Config *config);
+void config_run(void);
+bool config_load(struct Config *config);
 
 #endif /* MODULES_CONFIG_H_ */
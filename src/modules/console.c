@@ -0,0 +1,556 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "console.h"
+#include "config.h"
+#include "timer.h"
+#include "cyrf6936.h"
+#include "prof.h"
+
+/* The console line and output buffers */
+static char console_line[CONSOLE_LINE_LENGTH + 1];
+static uint8_t console_line_length = 0;
+static char console_msg[128];
+
+/**
+ * A config field which can be changed from the console
+ */
+struct ConsoleField {
+	const char *name;						/**< The field name in struct Config */
+	uint16_t offset;						/**< The offset in struct Config */
+	uint8_t size;							/**< The size of one element */
+	uint8_t count;							/**< The amount of elements */
+	bool is_signed;							/**< Whether the field is signed */
+	uint8_t max;							/**< The maximum value (0 when only limited by the size) */
+};
+#define CONSOLE_FIELD(field, is_signed) {#field, offsetof(struct Config, field), sizeof(usbrf_config.field), 1, is_signed, 0}
+#define CONSOLE_ARRAY(field, is_signed) {#field, offsetof(struct Config, field), sizeof(usbrf_config.field[0]), \
+		sizeof(usbrf_config.field) / sizeof(usbrf_config.field[0]), is_signed, 0}
+#define CONSOLE_RANGE(field, max) {#field, offsetof(struct Config, field), sizeof(usbrf_config.field), 1, false, max}
+#define CONSOLE_BOOL(field) CONSOLE_RANGE(field, 1)
+
+static const struct ConsoleField console_fields[] = {
+	CONSOLE_RANGE(protocol, PROTOCOL_NB - 1),
+	CONSOLE_BOOL(protocol_start),
+	CONSOLE_BOOL(debug_enable),
+	CONSOLE_BOOL(debug_button),
+	CONSOLE_BOOL(debug_cyrf6936),
+	CONSOLE_BOOL(debug_dsm),
+	CONSOLE_BOOL(debug_protocol),
+	CONSOLE_BOOL(debug_sched),
+	CONSOLE_FIELD(timer_scaler, false),
+	CONSOLE_FIELD(cyrf_spi_div, false),
+	CONSOLE_BOOL(capture_enable),
+	CONSOLE_RANGE(capture_format, CAPTURE_FORMAT_PCAPNG),
+	CONSOLE_BOOL(servo_ppm_enable),
+	CONSOLE_RANGE(servo_serial, SERVO_SERIAL_SRXL),
+	CONSOLE_BOOL(dsm_start_bind),
+	CONSOLE_RANGE(dsm_max_channel, DSM_MAX_CHANNEL),
+	CONSOLE_FIELD(dsm_bind_channel, true),
+	CONSOLE_ARRAY(dsm_bind_mfg_id, false),
+	CONSOLE_FIELD(dsm_protocol, false),
+	CONSOLE_FIELD(dsm_num_channels, false),
+	CONSOLE_BOOL(dsm_force_dsm2),
+	CONSOLE_FIELD(dsm_max_missed_packets, false),
+	CONSOLE_ARRAY(dsm_failsafe_us, false),
+	CONSOLE_FIELD(dsm_bind_packets, false),
+	CONSOLE_BOOL(dsm_mitm_both_data),
+	CONSOLE_BOOL(dsm_mitm_has_uplink),
+	CONSOLE_RANGE(dsm_tx_power, CYRF_PA_4),
+	CONSOLE_BOOL(dsm_tx_power_auto),
+	CONSOLE_FIELD(dsm_tx_power_rssi, false),
+	CONSOLE_BOOL(dsm_survey),
+	CONSOLE_FIELD(dsm_tx_deadline, false),
+	CONSOLE_BOOL(dsm_soft_crc),
+};
+#define CONSOLE_FIELDS_NB (sizeof(console_fields) / sizeof(console_fields[0]))
+
+/* The protocol names, in the order of enum Protocol */
+static const char *console_protocols[] = {"receiver", "transmitter", "mitm"};
+
+static void console_cmd_help(char *args);
+static void console_cmd_stop(char *args);
+static void console_cmd_start(char *args);
+static void console_cmd_protocol(char *args);
+static void console_cmd_get(char *args);
+static void console_cmd_set(char *args);
+static void console_cmd_list(char *args);
+static void console_cmd_store(char *args);
+static void console_cmd_tunnel(char *args);
+static void console_cmd_channels(char *args);
+static void console_cmd_noise(char *args);
+static void console_cmd_spi(char *args);
+static void console_cmd_boot(char *args);
+static void console_cmd_prof(char *args);
+static void console_cmd_lat(char *args);
+
+/* The console commands */
+static const struct ConsoleCommand console_commands[] = {
+	{"help",		"                  Show the commands", console_cmd_help},
+	{"stop",		"                  Stop the protocol", console_cmd_stop},
+	{"start",		"                  Start the protocol", console_cmd_start},
+	{"protocol",	"<name>            Switch to receiver, transmitter or mitm", console_cmd_protocol},
+	{"get",			"<field>[idx]      Show a config field", console_cmd_get},
+	{"set",			"<field>[idx] <v>  Change a config field", console_cmd_set},
+	{"list",		"                  Show all config fields", console_cmd_list},
+	{"store",		"                  Store the config in flash", console_cmd_store},
+	{"tunnel",		"                  Show the data tunnel statistics", console_cmd_tunnel},
+	{"channels",	"<v0> <v1> ...     Send up to 14 channels (-1000 to 1000) for testing", console_cmd_channels},
+	{"noise",		"                  Show the channel survey and the noise per hop", console_cmd_noise},
+	{"spi",			"                  Show the CYRF SPI divider and the hop time", console_cmd_spi},
+	{"boot",		"                  Show the boot timeline", console_cmd_boot},
+	{"prof",		"                  Show and reset the profiling zones (cycles)", console_cmd_prof},
+	{"lat",			"                  Show and reset the interrupt latency histograms", console_cmd_lat},
+};
+#define CONSOLE_COMMANDS_NB (sizeof(console_commands) / sizeof(console_commands[0]))
+
+/**
+ * Send formatted output to the console
+ */
+void console_printf(const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(console_msg, sizeof(console_msg), fmt, args);
+	va_end(args);
+
+	cdcacm_send(console_msg, strlen(console_msg));
+}
+
+/**
+ * Find a config field and its element index
+ * @param[in,out] name The field name with optional [idx], the index is stripped
+ * @param[out] idx The element index or -1 when no index was given
+ * @return The field or NULL when it doesn't exist
+ */
+static const struct ConsoleField *console_find_field(char *name, int16_t *idx) {
+	char *bracket = strchr(name, '[');
+	uint8_t i;
+
+	*idx = -1;
+	if (bracket != NULL) {
+		*bracket = '\0';
+		*idx = strtoul(bracket + 1, NULL, 0);
+	}
+
+	for (i = 0; i < CONSOLE_FIELDS_NB; i++) {
+		if (strcmp(console_fields[i].name, name) == 0)
+			return (*idx < console_fields[i].count)? &console_fields[i] : NULL;
+	}
+	return NULL;
+}
+
+/**
+ * Read a config field element
+ */
+static int32_t console_field_get(const struct ConsoleField *field, uint8_t idx) {
+	uint8_t *value = (uint8_t *)&usbrf_config + field->offset + idx * field->size;
+
+	switch (field->size) {
+	case 1:
+		return field->is_signed? *(int8_t *)value : *value;
+	case 2:
+		return field->is_signed? *(int16_t *)value : *(uint16_t *)value;
+	default:
+		return *(int32_t *)value;
+	}
+}
+
+/**
+ * Write a config field element
+ */
+static void console_field_set(const struct ConsoleField *field, uint8_t idx, int32_t data) {
+	uint8_t *value = (uint8_t *)&usbrf_config + field->offset + idx * field->size;
+	uint32_t mask = cm_mask_interrupts(1);
+
+	switch (field->size) {
+	case 1:
+		*value = data;
+		break;
+	case 2:
+		*(uint16_t *)value = data;
+		break;
+	default:
+		*(uint32_t *)value = data;
+		break;
+	}
+
+	cm_mask_interrupts(mask);
+}
+
+/**
+ * Print a config field with all its elements
+ */
+static void console_field_print(const struct ConsoleField *field) {
+	uint8_t i;
+
+	if (field->count == 1) {
+		console_printf("%s = %ld\r\n", field->name, (long)console_field_get(field, 0));
+		return;
+	}
+
+	for (i = 0; i < field->count; i++)
+		console_printf("%s[%u] = %ld\r\n", field->name, i, (long)console_field_get(field, i));
+}
+
+/**
+ * Stop the running protocol, the radio interrupts are masked so nothing is half way
+ */
+static void console_protocol_stop(void) {
+	uint32_t mask = cm_mask_interrupts(1);
+	protocol_functions[usbrf_config.protocol][PROTOCOL_STOP]();
+	cm_mask_interrupts(mask);
+}
+
+/**
+ * Initialize and start the configured protocol
+ */
+static void console_protocol_start(void) {
+	cyrf_reset();
+	protocol_functions[usbrf_config.protocol][PROTOCOL_INIT]();
+	protocol_functions[usbrf_config.protocol][PROTOCOL_START]();
+}
+
+static void console_cmd_help(char *args) {
+	uint8_t i;
+	(void) args;
+
+	for (i = 0; i < CONSOLE_COMMANDS_NB; i++)
+		console_printf("%-10s %s\r\n", console_commands[i].name, console_commands[i].help);
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_stop(char *args) {
+	(void) args;
+	console_protocol_stop();
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_start(char *args) {
+	(void) args;
+	console_protocol_stop();
+	console_protocol_start();
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_protocol(char *args) {
+	uint32_t start = timer_get_cycles();
+	uint8_t i;
+
+	for (i = 0; i < PROTOCOL_NB; i++) {
+		if (strcmp(args, console_protocols[i]) == 0)
+			break;
+	}
+	if (i >= PROTOCOL_NB) {
+		console_printf("ERR unknown protocol\r\n");
+		return;
+	}
+
+	// Switch the protocol
+	console_protocol_stop();
+	usbrf_config.protocol = i;
+	console_protocol_start();
+
+	console_printf("OK %s started in %luus\r\n", console_protocols[i], (unsigned long)((timer_get_cycles() - start) / 72));
+}
+
+static void console_cmd_get(char *args) {
+	const struct ConsoleField *field;
+	int16_t idx;
+
+	field = console_find_field(args, &idx);
+	if (field == NULL) {
+		console_printf("ERR unknown field\r\n");
+		return;
+	}
+
+	if (idx < 0)
+		console_field_print(field);
+	else
+		console_printf("%s[%d] = %ld\r\n", field->name, idx, (long)console_field_get(field, idx));
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_set(char *args) {
+	const struct ConsoleField *field;
+	char *value = strchr(args, ' ');
+	int32_t data;
+	int16_t idx;
+	uint8_t i;
+
+	if (value == NULL) {
+		console_printf("ERR missing value\r\n");
+		return;
+	}
+	*value++ = '\0';
+
+	field = console_find_field(args, &idx);
+	if (field == NULL) {
+		console_printf("ERR unknown field\r\n");
+		return;
+	}
+
+	// Reject values the protocols can't handle, like a protocol without functions
+	data = strtol(value, NULL, 0);
+	if (field->max != 0 && (data < 0 || data > field->max)) {
+		console_printf("ERR %s must be 0 to %u\r\n", field->name, field->max);
+		return;
+	}
+
+	// Without an index all elements are set
+	for (i = 0; i < field->count; i++) {
+		if (idx < 0 || idx == i)
+			console_field_set(field, i, data);
+	}
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_list(char *args) {
+	uint8_t i;
+	(void) args;
+
+	for (i = 0; i < CONSOLE_FIELDS_NB; i++)
+		console_field_print(&console_fields[i]);
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_store(char *args) {
+	(void) args;
+	config_store();
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_tunnel(char *args) {
+	static uint32_t last_time = 0, last_acked = 0, last_rx = 0;
+	struct TunnelStats stats;
+	uint32_t now, elapsed, mask;
+	(void) args;
+
+	// Take a copy, the radio interrupts update the statistics
+	mask = cm_mask_interrupts(1);
+	if (usbrf_config.protocol == DSM_TRANSMITTER)
+		stats = dsm_transmitter.tunnel.stats;
+	else if (usbrf_config.protocol == DSM_MITM)
+		stats = dsm_mitm.tunnel.stats;
+	else {
+		cm_mask_interrupts(mask);
+		console_printf("ERR no tunnel in this protocol\r\n");
+		return;
+	}
+	cm_mask_interrupts(mask);
+
+	console_printf("tx %lu packets, %lu frames, %lu retransmits, %lu bytes acked\r\n", (unsigned long)stats.tx_packets,
+			(unsigned long)stats.tx_frames, (unsigned long)stats.tx_retransmits, (unsigned long)stats.tx_bytes_acked);
+	console_printf("rx %lu packets, %lu duplicates, %lu bytes\r\n", (unsigned long)stats.rx_packets,
+			(unsigned long)stats.rx_duplicates, (unsigned long)stats.rx_bytes);
+
+	// The effective throughput since the previous call
+	now = timer_get_time();
+	elapsed = now - last_time;
+	if (last_time != 0 && elapsed > 0 && stats.tx_bytes_acked >= last_acked && stats.rx_bytes >= last_rx)
+		console_printf("rate tx %lu B/s, rx %lu B/s\r\n",
+				(unsigned long)((uint64_t)(stats.tx_bytes_acked - last_acked) * 100000 / elapsed),
+				(unsigned long)((uint64_t)(stats.rx_bytes - last_rx) * 100000 / elapsed));
+	last_time = now;
+	last_acked = stats.tx_bytes_acked;
+	last_rx = stats.rx_bytes;
+
+	// The host write to air latency of the transmitter
+	if (usbrf_config.protocol == DSM_TRANSMITTER && dsm_transmitter.tx_latency_count > 0)
+		console_printf("latency avg %luus, max %luus\r\n",
+				(unsigned long)(dsm_transmitter.tx_latency_sum / dsm_transmitter.tx_latency_count * 10),
+				(unsigned long)(dsm_transmitter.tx_latency_max * 10));
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_channels(char *args) {
+	int16_t channels[CONVERT_MAX_CHANNELS];
+	uint8_t count = 0;
+	char *end;
+	long value;
+
+	// Parse the values until the end of the line
+	while (count < CONVERT_MAX_CHANNELS) {
+		value = strtol(args, &end, 0);
+		if (end == args)
+			break;
+		if (value < -CONVERT_NORM_MAX || value > CONVERT_NORM_MAX) {
+			console_printf("ERR channel %u out of range\r\n", count);
+			return;
+		}
+		channels[count++] = value;
+		args = end;
+	}
+
+	if (count == 0) {
+		console_printf("ERR missing channels\r\n");
+		return;
+	}
+	if (usbrf_config.protocol != DSM_TRANSMITTER) {
+		console_printf("ERR not a transmitter\r\n");
+		return;
+	}
+
+	dsm_transmitter_set_channels(channels, count);
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_noise(char *args) {
+	uint8_t i, hops, max_channel;
+	(void) args;
+
+	if (usbrf_config.protocol != DSM_TRANSMITTER) {
+		console_printf("ERR not a transmitter\r\n");
+		return;
+	}
+
+	// The survey at start
+	if (dsm_transmitter.surveyed) {
+		max_channel = (usbrf_config.dsm_max_channel > DSM_MAX_CHANNEL)? DSM_MAX_CHANNEL : usbrf_config.dsm_max_channel;
+		for (i = 0; i <= max_channel; i++)
+			console_printf("%s0x%02X:%u%s", (i % 8 == 0)? "survey " : "", i, dsm_transmitter.survey_noise[i],
+					(i % 8 == 7 || i == max_channel)? "\r\n" : " ");
+		console_printf("dsm2 0x%02X 0x%02X, bind 0x%02X\r\n", dsm_transmitter.survey_dsm2[0],
+				dsm_transmitter.survey_dsm2[1], dsm_transmitter.survey_bind);
+	}
+
+	// The average noise in the empty telemetry slots
+	hops = IS_DSM2(dsm_transmitter.protocol)? 2 : 23;
+	for (i = 0; i < hops; i++)
+		console_printf("hop %2u channel 0x%02X noise %u.%u\r\n", i, dsm_transmitter.rf_channels[i],
+				dsm_transmitter.hop_noise[i] >> 4, ((dsm_transmitter.hop_noise[i] & 0xF) * 10) >> 4);
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_spi(char *args) {
+	(void) args;
+
+	console_printf("div %u%s\r\n", cyrf_spi_info.div, cyrf_spi_info.probed? " probed" : "");
+	console_printf("hop %lu cycles %luus, %lu cycles %luus at div 64\r\n",
+			(unsigned long)cyrf_spi_info.hop_cycles, (unsigned long)(cyrf_spi_info.hop_cycles / 72),
+			(unsigned long)cyrf_spi_info.hop_cycles_default, (unsigned long)(cyrf_spi_info.hop_cycles_default / 72));
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_boot(char *args) {
+	(void) args;
+
+	// The times are in 10 microseconds since boot
+	console_printf("radio reset %luus\r\n", (unsigned long)boot_timeline.radio_reset * 10);
+	console_printf("radio ready %luus\r\n", (unsigned long)boot_timeline.radio_ready * 10);
+	console_printf("protocol start %luus\r\n", (unsigned long)boot_timeline.protocol_start * 10);
+	console_printf("first send %luus\r\n", (unsigned long)boot_timeline.first_send * 10);
+	console_printf("first recv %luus\r\n", (unsigned long)boot_timeline.first_recv * 10);
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_prof(char *args) {
+	struct ProfZone zones[PROF_ZONE_NB];
+	uint32_t elapsed, load;
+	uint8_t i;
+	(void) args;
+
+	elapsed = prof_take(zones);
+	console_printf("over %lums\r\n", (unsigned long)(elapsed / 100));
+	for (i = 0; i < PROF_ZONE_NB; i++) {
+		if (zones[i].count == 0) {
+			console_printf("%-10s 0\r\n", prof_zone_names[i]);
+			continue;
+		}
+
+		// The load in 0.01%, there are 720 cycles in 10 microseconds
+		load = zones[i].sum * 10000 / ((uint64_t)elapsed * 720 + 1);
+		console_printf("%-10s %lu min %lu avg %lu max %lu load %lu.%02lu%%\r\n", prof_zone_names[i],
+				(unsigned long)zones[i].count, (unsigned long)zones[i].min,
+				(unsigned long)(zones[i].sum / zones[i].count), (unsigned long)zones[i].max,
+				(unsigned long)(load / 100), (unsigned long)(load % 100));
+	}
+	console_printf("OK\r\n");
+}
+
+static void console_cmd_lat(char *args) {
+	struct ProfLatency latency[PROF_LAT_NB];
+	uint8_t i, j;
+	(void) args;
+
+	// The bins are in CPU cycles, 72 per microsecond
+	prof_take_latency(latency);
+	console_printf("bins <32 32 64 128 256 512 1024 2048+ cycles\r\n");
+	for (i = 0; i < PROF_LAT_NB; i++) {
+		console_printf("%-10s", prof_latency_names[i]);
+		for (j = 0; j < PROF_LAT_BINS; j++)
+			console_printf(" %lu", (unsigned long)latency[i].bins[j]);
+		console_printf(" max %lu cycles\r\n", (unsigned long)latency[i].max);
+	}
+	console_printf("OK\r\n");
+}
+
+/**
+ * Execute a command line
+ */
+static void console_execute(char *line) {
+	char *args = strchr(line, ' ');
+	uint8_t i;
+
+	// Split the command and the arguments
+	if (args != NULL)
+		*args++ = '\0';
+	else
+		args = line + strlen(line);
+
+	for (i = 0; i < CONSOLE_COMMANDS_NB; i++) {
+		if (strcmp(line, console_commands[i].name) == 0) {
+			console_commands[i].func(args);
+			return;
+		}
+	}
+
+	console_printf("ERR unknown command, try help\r\n");
+}
+
+/**
+ * Receive console input from the CDCACM
+ */
+static void console_receive_cb(char *data, int size) {
+	int i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == '\r' || data[i] == '\n') {
+			console_line[console_line_length] = '\0';
+			if (console_line_length > 0)
+				console_execute(console_line);
+			console_line_length = 0;
+		} else if (console_line_length < CONSOLE_LINE_LENGTH) {
+			console_line[console_line_length++] = data[i];
+		}
+	}
+}
+
+/**
+ * Initialize the console
+ */
+void console_init(void) {
+	cdcacm_register_console_callback(console_receive_cb);
+}
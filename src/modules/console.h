@@ -0,0 +1,41 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MODULES_CONSOLE_H_
+#define MODULES_CONSOLE_H_
+
+#include <libopencm3/cm3/common.h>
+
+#define CONSOLE_LINE_LENGTH		64			/**< The maximum length of a command line */
+
+/**
+ * A console command
+ */
+struct ConsoleCommand {
+	const char *name;						/**< The command name */
+	const char *help;						/**< The arguments and a short description */
+	void (*func)(char *args);				/**< The command handler with the rest of the line */
+};
+
+/* External functions */
+void console_init(void);
+void console_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif /* MODULES_CONSOLE_H_ */
@@ -18,6 +18,7 @@
  */
 
 #include <unistd.h>
+#include <string.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/spi.h>
@@ -26,34 +27,34 @@
 
 #include "cyrf6936.h"
 #include "config.h"
+#include "timer.h"
+#include "prof.h"
+#include "ramfunc.h"
 
 /* The CYRF receive and send callbacks */
 cyrf_on_event _cyrf_recv_callback = NULL;
 cyrf_on_event _cyrf_send_callback = NULL;
 
-/* The pin for selecting the device */
-#define CYRF_CS_HI() gpio_set(CYRF_DEV_SS_PORT, CYRF_DEV_SS_PIN)
-#define CYRF_CS_LO() gpio_clear(CYRF_DEV_SS_PORT, CYRF_DEV_SS_PIN)
+/* The shadow of the TX config register, so the power can change without a read */
+static uint8_t cyrf_tx_cfg = 0;
 
-// TODO: Fix a nice delay
-void Delay(uint32_t x);
-void Delay(uint32_t x)
-{
-    (void)x;
-    __asm ("mov r1, #24;"
-         "mul r0, r0, r1;"
-         "b _delaycmp;"
-         "_delayloop:"
-         "subs r0, r0, #1;"
-         "_delaycmp:;"
-         "cmp r0, #0;"
-         " bne _delayloop;");
-}
+/* The SPI clock and the hop time */
+struct CyrfSpiInfo cyrf_spi_info = {64, false, 0, 0};
+
+static void cyrf_set_spi_baudrate(const uint8_t br);
+static bool cyrf_test_spi(void);
+static uint32_t cyrf_measure_hop(void);
+static void cyrf_select_spi_div(void);
+
+/* The last reset and whether the CYRF came out of it */
+static uint32_t cyrf_reset_time = 0;
+static bool cyrf_ready = false;
 
 /**
- * Initialize the CYRF6936
+ * Initialize the CYRF6936 and start the hardware reset, cyrf_is_ready tells when it is done
  */
 void cyrf_init(void) {
+	uint32_t start;
 	DEBUG(cyrf6936, "Initializing");
 	/* Initialize the clocks */
 	rcc_peripheral_enable_clock(&RCC_APB2ENR, CYRF_DEV_SPI_CLK); //SPI
@@ -104,37 +105,173 @@ void cyrf_init(void) {
 	spi_enable(CYRF_DEV_SPI);
 
 	/* Reset the CYRF chip */
+	start = timer_get_time();
 	gpio_set(CYRF_DEV_RST_PORT, CYRF_DEV_RST_PIN);
-	Delay(100);
+	while (timer_get_time() - start < CYRF_RESET_PULSE);
 	gpio_clear(CYRF_DEV_RST_PORT, CYRF_DEV_RST_PIN);
-	Delay(100);
 
-	/* Also a software reset */
-	cyrf_write_register(CYRF_MODE_OVERRIDE, CYRF_RST);
+	cyrf_tx_cfg = CYRF_DATA_MODE_GFSK | CYRF_PA_M5; // The reset value of the TX config
+	cyrf_reset_time = timer_get_time();
+	cyrf_ready = false;
+	boot_timeline.radio_reset = cyrf_reset_time;
 	DEBUG(cyrf6936, "Initializing done");
 }
 
+/**
+ * Check whether the CYRF came out of the last reset, without blocking
+ * @return True when the registers respond and the crystal is stable, or the maximum wait passed
+ */
+bool cyrf_is_ready(void) {
+	uint32_t elapsed;
+	if (cyrf_ready)
+		return true;
+
+	// The registers respond and the crystal reports stable
+	elapsed = timer_get_time() - cyrf_reset_time;
+	cyrf_write_register(CYRF_CRC_SEED_LSB, 0x5A);
+	if ((cyrf_read_register(CYRF_CRC_SEED_LSB) == 0x5A && (cyrf_read_register(CYRF_TX_IRQ_STATUS) & CYRF_OS_IRQ))
+			|| elapsed >= CYRF_READY_TIMEOUT) {
+		cyrf_ready = true;
+		if (boot_timeline.radio_ready == 0)
+			boot_timeline.radio_ready = timer_get_time();
+		DEBUG(cyrf6936, "Ready after %luus%s", (unsigned long)elapsed * 10, (elapsed >= CYRF_READY_TIMEOUT)? " (timeout)" : "");
+	}
+	return cyrf_ready;
+}
+
+/**
+ * Setup the CYRF after the hardware reset, this selects the SPI clock
+ */
+void cyrf_setup(void) {
+	while (!cyrf_is_ready());
+	cyrf_select_spi_div();
+}
+
+/**
+ * Do a software reset of the CYRF and wait until it is ready again
+ */
+void cyrf_reset(void) {
+	cyrf_write_register(CYRF_MODE_OVERRIDE, CYRF_RST);
+	cyrf_tx_cfg = CYRF_DATA_MODE_GFSK | CYRF_PA_M5; // The reset value of the TX config
+	cyrf_reset_time = timer_get_time();
+	cyrf_ready = false;
+	while (!cyrf_is_ready());
+}
+
+/**
+ * Change the SPI baudrate bits while the SPI is idle
+ * @param[in] br The baudrate bits (the divider is 2 << br)
+ */
+static void cyrf_set_spi_baudrate(const uint8_t br) {
+	spi_disable(CYRF_DEV_SPI);
+	SPI_CR1(CYRF_DEV_SPI) = (SPI_CR1(CYRF_DEV_SPI) & ~SPI_CR1_BAUDRATE_FPCLK_DIV_256) | (br << 3);
+	spi_enable(CYRF_DEV_SPI);
+}
+
+/**
+ * Write and read back test patterns in the SOP code registers
+ * @return Whether all patterns were read back correctly
+ */
+static bool cyrf_test_spi(void) {
+	static const uint8_t patterns[4][8] = {
+		{0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55},
+		{0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA},
+		{0x00, 0xFF, 0x00, 0xFF, 0xFF, 0x00, 0xFF, 0x00},
+		{0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80},
+	};
+	uint8_t read[8];
+	uint8_t round, i;
+
+	for (round = 0; round < CYRF_SPI_PROBE_ROUNDS; round++) {
+		for (i = 0; i < 4; i++) {
+			cyrf_write_block(CYRF_SOP_CODE, patterns[i], 8);
+			cyrf_read_block(CYRF_SOP_CODE, read, 8);
+			if (memcmp(read, patterns[i], 8) != 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Measure the register writes of a DSM hop (channel, CRC seed, SOP and data code)
+ * @return The time in CPU cycles
+ */
+static uint32_t cyrf_measure_hop(void) {
+	uint8_t code[16] = {0};
+	uint32_t start = timer_get_cycles();
+
+	cyrf_write_register(CYRF_CHANNEL, 0);
+	cyrf_write_register(CYRF_CRC_SEED_LSB, 0);
+	cyrf_write_register(CYRF_CRC_SEED_MSB, 0);
+	cyrf_write_block(CYRF_SOP_CODE, code, 8);
+	cyrf_write_block(CYRF_DATA_CODE, code, 16);
+	return timer_get_cycles() - start;
+}
+
+/**
+ * Select the SPI clock divider from the config, or probe the fastest reliable one up to the board maximum
+ */
+static void cyrf_select_spi_div(void) {
+	int8_t br, best = SPI_CR1_BAUDRATE_FPCLK_DIV_64 >> 3;
+
+	cyrf_spi_info.hop_cycles_default = cyrf_measure_hop();
+
+	if (usbrf_config.cyrf_spi_div == 0) {
+		// Go faster until a pattern fails
+		for (br = best - 1; br >= (CYRF_DEV_SPI_MAX_DIV >> 3); br--) {
+			cyrf_set_spi_baudrate(br);
+			if (!cyrf_test_spi())
+				break;
+			best = br;
+		}
+		cyrf_spi_info.probed = true;
+	} else {
+		// Take the configured divider (rounded up to a power of two), never faster than the board maximum
+		for (best = CYRF_DEV_SPI_MAX_DIV >> 3; best < 7 && (2 << best) < usbrf_config.cyrf_spi_div; best++);
+		cyrf_spi_info.probed = false;
+	}
+
+	cyrf_set_spi_baudrate(best);
+	cyrf_spi_info.div = 2 << best;
+	cyrf_spi_info.hop_cycles = cyrf_measure_hop();
+	DEBUG(cyrf6936, "SPI divider %d%s, hop %lu cycles (%lu at divider 64)", cyrf_spi_info.div,
+			cyrf_spi_info.probed? " (probed)" : "", (unsigned long)cyrf_spi_info.hop_cycles,
+			(unsigned long)cyrf_spi_info.hop_cycles_default);
+}
+
 /**
  * On interrupt request
  */
-void CYRF_DEV_IRQ_ISR(void) {
+void RAMFUNC CYRF_DEV_IRQ_ISR(void) {
 	uint8_t tx_irq_status, rx_irq_status;
+	PROF_ENTER(PROF_CYRF_IRQ);
+	prof_latency(PROF_LAT_CYRF_IRQ, timer_cyrf_irq_age());
 
 	// Read the transmit IRQ
-	tx_irq_status = cyrf_read_register(CYRF_TX_IRQ_STATUS);
+	tx_irq_status = cyrf_read_register_inline(CYRF_TX_IRQ_STATUS);
+	if ((tx_irq_status & CYRF_TXC_IRQ) && boot_timeline.first_send == 0)
+		boot_timeline.first_send = timer_get_time();
 	if (((tx_irq_status & CYRF_TXC_IRQ) || (tx_irq_status & CYRF_TXE_IRQ))
 			&& _cyrf_send_callback != NULL) {
+		PROF_ENTER(PROF_CYRF_SEND);
 		_cyrf_send_callback((tx_irq_status & CYRF_TXE_IRQ) > 0x0);
+		PROF_EXIT(PROF_CYRF_SEND);
 	}
 
 	// Read the read IRQ
-	rx_irq_status = cyrf_read_register(CYRF_RX_IRQ_STATUS);
+	rx_irq_status = cyrf_read_register_inline(CYRF_RX_IRQ_STATUS);
+	if ((rx_irq_status & CYRF_RXC_IRQ) && !(rx_irq_status & CYRF_RXE_IRQ) && boot_timeline.first_recv == 0)
+		boot_timeline.first_recv = timer_get_time();
 	if (((rx_irq_status & CYRF_RXC_IRQ) || (rx_irq_status & CYRF_RXE_IRQ))
 			&& _cyrf_recv_callback != NULL) {
+		PROF_ENTER(PROF_CYRF_RECV);
 		_cyrf_recv_callback((rx_irq_status & CYRF_RXE_IRQ) > 0x0);
+		PROF_EXIT(PROF_CYRF_RECV);
 	}
 
 	exti_reset_request(CYRF_DEV_IRQ_EXTI);
+	PROF_EXIT(PROF_CYRF_IRQ);
 }
 
 /**
@@ -158,11 +295,11 @@ void cyrf_register_send_callback(cyrf_on_event callback) {
  * @param[in] address The one byte address number of the register
  * @param[in] data The one byte data that needs to be written to the address
  */
-void cyrf_write_register(const uint8_t address, const uint8_t data) {
-	CYRF_CS_LO();
-	spi_xfer(CYRF_DEV_SPI, CYRF_DIR | address);
-	spi_xfer(CYRF_DEV_SPI, data);
-	CYRF_CS_HI();
+void RAMFUNC cyrf_write_register(const uint8_t address, const uint8_t data) {
+	if (address == CYRF_TX_CFG)
+		cyrf_tx_cfg = data;
+
+	cyrf_write_register_inline(address, data);
 }
 
 /**
@@ -171,15 +308,8 @@ void cyrf_write_register(const uint8_t address, const uint8_t data) {
  * @param[in] data The data that needs to be written to the address
  * @param[in] length The length in bytes of the data that needs to be written
  */
-void cyrf_write_block(const uint8_t address, const uint8_t data[], const int length) {
-	int i;
-	CYRF_CS_LO();
-	spi_xfer(CYRF_DEV_SPI, CYRF_DIR | address);
-
-	for (i = 0; i < length; i++)
-		spi_xfer(CYRF_DEV_SPI, data[i]);
-
-	CYRF_CS_HI();
+void RAMFUNC cyrf_write_block(const uint8_t address, const uint8_t data[], const int length) {
+	cyrf_write_block_inline(address, data, length);
 }
 
 /**
@@ -187,13 +317,8 @@ void cyrf_write_block(const uint8_t address, const uint8_t data[], const int len
  * @param[in] The one byte address of the register
  * @return The one byte data of the register
  */
-uint8_t cyrf_read_register(const uint8_t address) {
-	uint8_t data;
-	CYRF_CS_LO();
-	spi_xfer(CYRF_DEV_SPI, address);
-	data = spi_xfer(CYRF_DEV_SPI, 0);
-	CYRF_CS_HI();
-	return data;
+uint8_t RAMFUNC cyrf_read_register(const uint8_t address) {
+	return cyrf_read_register_inline(address);
 }
 
 /**
@@ -202,13 +327,13 @@ uint8_t cyrf_read_register(const uint8_t address) {
  * @param[out] data The data that was received from the register
  * @param[in] length The length in bytes what needs to be read
  */
-void cyrf_read_block(const uint8_t address, uint8_t data[], const int length) {
+void RAMFUNC cyrf_read_block(const uint8_t address, uint8_t data[], const int length) {
 	int i;
 	CYRF_CS_LO();
-	spi_xfer(CYRF_DEV_SPI, address);
+	cyrf_xfer(address);
 
 	for (i = 0; i < length; i++)
-		data[i] = spi_xfer(CYRF_DEV_SPI, 0);
+		data[i] = cyrf_xfer(0);
 
 	CYRF_CS_HI();
 }
@@ -226,10 +351,38 @@ void cyrf_get_mfg_id(uint8_t *mfg_id) {
 
 /**
  * Get the RSSI (signal strength) of the last received packet
- * @return The RSSI of the last received packet
+ * @return The RSSI of the last received packet (0 to 31)
  */
 uint8_t cyrf_get_rssi(void) {
-	return cyrf_read_register(CYRF_RSSI) & 0x0F;
+	return cyrf_read_register(CYRF_RSSI) & 0x1F;
+}
+
+/**
+ * Measure the RSSI (noise) of a channel without receiving a packet, the radio must be idle
+ * @param[in] chan The channel that needs to be measured
+ * @return The highest RSSI (0-31) of CYRF_RSSI_SAMPLES samples
+ */
+uint8_t cyrf_measure_rssi(const uint8_t chan) {
+	uint8_t i, rssi, rssi_max = 0;
+	uint32_t start;
+
+	// Start receiving without interrupts
+	cyrf_set_channel(chan);
+	cyrf_write_register(CYRF_RX_CTRL, CYRF_RX_GO);
+
+	for (i = 0; i < CYRF_RSSI_SAMPLES; i++) {
+		// Let the receiver settle, every read starts a new measurement
+		start = timer_get_time();
+		while (timer_get_time() - start < CYRF_RSSI_SETTLE);
+
+		rssi = cyrf_read_register(CYRF_RSSI) & 0x1F;
+		rssi_max = (rssi > rssi_max)? rssi : rssi_max;
+	}
+
+	// Abort the receive
+	cyrf_write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_RX | CYRF_FRC_END);
+	cyrf_write_register(CYRF_RX_ABORT, 0x00);
+	return rssi_max;
 }
 
 /**
@@ -257,21 +410,32 @@ void cyrf_set_config_len(const uint8_t config[][2], const uint8_t length) {
  * Set the RF channel
  * @param[in] chan The channel needs to be set
  */
-void cyrf_set_channel(const uint8_t chan) {
-	cyrf_write_register(CYRF_CHANNEL, chan);
+void RAMFUNC cyrf_set_channel(const uint8_t chan) {
+	cyrf_write_register_inline(CYRF_CHANNEL, chan);
 	DEBUG(cyrf6936, "WRITE CHANNEL: 0x%02X", chan);
 }
 
 /**
- * Set the power
+ * Set the power, only writes the register when the power changes
  * @param[in] power The power that needs to be set
  */
 void cyrf_set_power(const uint8_t power) {
-	uint8_t tx_cfg = cyrf_read_register(CYRF_TX_CFG) & (0xFF - CYRF_PA_4);
-	cyrf_write_register(CYRF_TX_CFG, tx_cfg | power);
+	uint8_t tx_cfg = (cyrf_tx_cfg & (0xFF - CYRF_PA_4)) | (power & CYRF_PA_4);
+	if (tx_cfg == cyrf_tx_cfg)
+		return;
+
+	cyrf_write_register(CYRF_TX_CFG, tx_cfg);
 	DEBUG(cyrf6936, "WRITE POWER: 0x%02X (0x%02X)", power, tx_cfg);
 }
 
+/**
+ * Get the power from the TX config shadow
+ * @return The current power
+ */
+uint8_t cyrf_get_power(void) {
+	return cyrf_tx_cfg & CYRF_PA_4;
+}
+
 /**
  * Set the mode
  * @param[in] mode The mode that the chip needs to be set to
@@ -290,9 +454,9 @@ void cyrf_set_mode(const uint8_t mode, const bool force) {
  * Set the CRC seed
  * @param[in] crc The 16-bit CRC seed
  */
-void cyrf_set_crc_seed(const uint16_t crc) {
-	cyrf_write_register(CYRF_CRC_SEED_LSB, crc & 0xff);
-	cyrf_write_register(CYRF_CRC_SEED_MSB, crc >> 8);
+void RAMFUNC cyrf_set_crc_seed(const uint16_t crc) {
+	cyrf_write_register_inline(CYRF_CRC_SEED_LSB, crc & 0xff);
+	cyrf_write_register_inline(CYRF_CRC_SEED_MSB, crc >> 8);
 
 	DEBUG(cyrf6936, "WRITE CRC: 0x%02X LSB 0x%02X MSB", crc & 0xff, crc >> 8);
 }
@@ -301,8 +465,8 @@ void cyrf_set_crc_seed(const uint16_t crc) {
  * Set the SOP code
  * @param[in] sopcode The 8 bytes SOP code
  */
-void cyrf_set_sop_code(const uint8_t *sopcode) {
-	cyrf_write_block(CYRF_SOP_CODE, sopcode, 8);
+void RAMFUNC cyrf_set_sop_code(const uint8_t *sopcode) {
+	cyrf_write_block_inline(CYRF_SOP_CODE, sopcode, 8);
 
 	DEBUG(cyrf6936, "WRITE SOP_CODE: 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X",
 			sopcode[0], sopcode[1], sopcode[2], sopcode[3], sopcode[4], sopcode[5], sopcode[6], sopcode[7]);
@@ -312,8 +476,8 @@ void cyrf_set_sop_code(const uint8_t *sopcode) {
  * Set the data code
  * @param[in] datacode The 16 bytes data code
  */
-void cyrf_set_data_code(const uint8_t *datacode) {
-	cyrf_write_block(CYRF_DATA_CODE, datacode, 16);
+void RAMFUNC cyrf_set_data_code(const uint8_t *datacode) {
+	cyrf_write_block_inline(CYRF_DATA_CODE, datacode, 16);
 
 	DEBUG(cyrf6936, "WRITE DATA_CODE: 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X",
 			datacode[0], datacode[1], datacode[2], datacode[3], datacode[4], datacode[5], datacode[6], datacode[7],
@@ -20,6 +20,9 @@
 #ifndef MODULES_CYRF6936_H_
 #define MODULES_CYRF6936_H_
 
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/spi.h>
+
 // Include the board specifications for the CYRF define
 #include "../board.h"
 
@@ -204,8 +207,26 @@ enum {
 };
 #define CYRF_DATA_CODE_LENGTH	(1<<5)
 
+#define CYRF_RSSI_SAMPLES		4				/**< The RSSI samples when measuring a channel */
+#define CYRF_RSSI_SETTLE		10				/**< The time between the RSSI samples in 10 microseconds */
+#define CYRF_RESET_PULSE		10				/**< The time the reset pin is held high in 10 microseconds */
+#define CYRF_READY_TIMEOUT		300				/**< The maximum wait for the registers and the crystal after a reset in 10 microseconds */
+#define CYRF_SPI_PROBE_ROUNDS	16				/**< The times every test pattern is written and read back per divider */
+
+/* The SPI clock and the time it takes to hop, measured at startup */
+struct CyrfSpiInfo {
+	uint16_t div;							/**< The selected SPI clock divider */
+	bool probed;							/**< Whether the divider was selected by the probe */
+	uint32_t hop_cycles_default;			/**< The hop register writes in CPU cycles at the default divider of 64 */
+	uint32_t hop_cycles;					/**< The hop register writes in CPU cycles at the selected divider */
+};
+extern struct CyrfSpiInfo cyrf_spi_info;
+
 /* The external functions */
 void cyrf_init(void);
+bool cyrf_is_ready(void);
+void cyrf_setup(void);
+void cyrf_reset(void);
 
 typedef void (*cyrf_on_event) (const bool error);
 void cyrf_register_recv_callback(cyrf_on_event callback);
@@ -216,12 +237,72 @@ void cyrf_write_block(const uint8_t address, const uint8_t data[], const int len
 uint8_t   cyrf_read_register(const uint8_t address);
 void cyrf_read_block(const uint8_t address, uint8_t *data, const int length);
 
+/* The pin for selecting the device, directly on the registers so it stays in the RAM functions */
+#define CYRF_CS_HI() GPIO_BSRR(CYRF_DEV_SS_PORT) = CYRF_DEV_SS_PIN
+#define CYRF_CS_LO() GPIO_BRR(CYRF_DEV_SS_PORT) = CYRF_DEV_SS_PIN
+
+/**
+ * Transfer one byte over the SPI, the same as spi_xfer but inlined in the RAM functions
+ * @param[in] data The byte to send
+ * @return The received byte
+ */
+static inline __attribute__((always_inline)) uint8_t cyrf_xfer(const uint8_t data) {
+	SPI_DR(CYRF_DEV_SPI) = data;
+	while (!(SPI_SR(CYRF_DEV_SPI) & SPI_SR_RXNE));
+	return SPI_DR(CYRF_DEV_SPI);
+}
+
+/**
+ * Write a byte to the register, inlined in the RAMFUNC hot path (doesn't update the TX config shadow)
+ * @param[in] address The one byte address number of the register
+ * @param[in] data The one byte data that needs to be written to the address
+ */
+static inline __attribute__((always_inline)) void cyrf_write_register_inline(const uint8_t address, const uint8_t data) {
+	CYRF_CS_LO();
+	cyrf_xfer(CYRF_DIR | address);
+	cyrf_xfer(data);
+	CYRF_CS_HI();
+}
+
+/**
+ * Write a block to the register, inlined in the RAMFUNC hot path
+ * @param[in] address The one byte address number of the register
+ * @param[in] data The data that needs to be written to the address
+ * @param[in] length The length in bytes of the data that needs to be written
+ */
+static inline __attribute__((always_inline)) void cyrf_write_block_inline(const uint8_t address, const uint8_t data[], const int length) {
+	int i;
+	CYRF_CS_LO();
+	cyrf_xfer(CYRF_DIR | address);
+
+	for (i = 0; i < length; i++)
+		cyrf_xfer(data[i]);
+
+	CYRF_CS_HI();
+}
+
+/**
+ * Read a byte from the register, inlined in the RAMFUNC hot path
+ * @param[in] The one byte address of the register
+ * @return The one byte data of the register
+ */
+static inline __attribute__((always_inline)) uint8_t cyrf_read_register_inline(const uint8_t address) {
+	uint8_t data;
+	CYRF_CS_LO();
+	cyrf_xfer(address);
+	data = cyrf_xfer(0);
+	CYRF_CS_HI();
+	return data;
+}
+
 void cyrf_get_mfg_id(uint8_t *mfg);
 uint8_t   cyrf_get_rssi(void);
+uint8_t   cyrf_measure_rssi(const uint8_t chan);
 uint8_t   cyrf_get_rx_status(void);
 void cyrf_set_config_len(const uint8_t config[][2], const uint8_t length);
 void cyrf_set_channel(const uint8_t chan);
 void cyrf_set_power(const uint8_t power);
+uint8_t cyrf_get_power(void);
 void cyrf_set_mode(const uint8_t mode, const bool force);
 void cyrf_set_crc_seed(const uint16_t crc);
 void cyrf_set_sop_code(const uint8_t *sopcode);
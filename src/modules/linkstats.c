@@ -0,0 +1,123 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "linkstats.h"
+#include "config.h"
+#include "cyrf6936.h"
+#include "capture.h"
+
+/* The statistics of the current interval */
+static struct LinkStatsHop linkstats_hops[LINKSTATS_HOPS];
+
+/**
+ * Get the histogram bin of a value, every bin is twice as wide as the previous
+ */
+static uint8_t linkstats_log2_bin(uint16_t value) {
+	uint8_t bin = 0;
+
+	while (value > 1 && bin < LINKSTATS_JITTER_BINS - 1) {
+		value >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+/**
+ * Reset all the link statistics
+ */
+void linkstats_reset(void) {
+	uint32_t mask = cm_mask_interrupts(1);
+	uint8_t i;
+
+	memset(linkstats_hops, 0, sizeof(linkstats_hops));
+	for (i = 0; i < LINKSTATS_HOPS; i++)
+		linkstats_hops[i].hop = i;
+
+	cm_mask_interrupts(mask);
+}
+
+/**
+ * Count a received packet, called from the receive callbacks
+ * @param[in] hop The hop index
+ * @param[in] channel The RF channel
+ * @param[in] rssi The RSSI register
+ * @param[in] rx_status The RX status register
+ * @param[in] arrival The time since the timer was set in 10 microseconds
+ */
+void linkstats_receive(uint8_t hop, uint8_t channel, uint8_t rssi, uint8_t rx_status, uint16_t arrival) {
+	struct LinkStatsHop *stats = &linkstats_hops[hop % LINKSTATS_HOPS];
+	uint16_t jitter;
+
+	stats->channel = channel;
+	stats->received++;
+	if (rx_status & CYRF_BAD_CRC)
+		stats->bad_crc++;
+	stats->rssi[(rssi & 0x1F) >> 2]++;
+
+	// The jitter is the difference with the previous arrival on this hop
+	if (stats->received > 1) {
+		jitter = (arrival > stats->last_arrival)? arrival - stats->last_arrival : stats->last_arrival - arrival;
+		stats->jitter[linkstats_log2_bin(jitter)]++;
+	}
+	stats->last_arrival = arrival;
+}
+
+/**
+ * Count a missed packet, called from the timer callbacks
+ * @param[in] hop The hop index
+ */
+void linkstats_timeout(uint8_t hop) {
+	linkstats_hops[hop % LINKSTATS_HOPS].timeouts++;
+}
+
+/**
+ * Count a packet rejected by the software CRC check, called from the receive callbacks
+ * @param[in] hop The hop index
+ */
+void linkstats_crc_error(uint8_t hop) {
+	linkstats_hops[hop % LINKSTATS_HOPS].bad_crc++;
+}
+
+/**
+ * Send the link statistics of the active hops and start a new interval
+ */
+void linkstats_run(void) {
+	struct LinkStatsHop stats;
+	uint32_t mask;
+	uint8_t i;
+
+	for (i = 0; i < LINKSTATS_HOPS; i++) {
+		// Take the statistics and clear them, but keep the arrival for the jitter
+		mask = cm_mask_interrupts(1);
+		stats = linkstats_hops[i];
+		memset(&linkstats_hops[i].received, 0, offsetof(struct LinkStatsHop, last_arrival) - offsetof(struct LinkStatsHop, received));
+		cm_mask_interrupts(mask);
+
+		if (stats.received == 0 && stats.timeouts == 0)
+			continue;
+
+		if (usbrf_config.capture_enable && usbrf_config.capture_format == CAPTURE_FORMAT_RECORD)
+			capture_send(CAPTURE_TYPE_LINKSTATS, &stats, offsetof(struct LinkStatsHop, last_arrival));
+	}
+}
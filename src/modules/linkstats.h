@@ -0,0 +1,52 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MODULES_LINKSTATS_H_
+#define MODULES_LINKSTATS_H_
+
+#include <libopencm3/cm3/common.h>
+
+#define LINKSTATS_HOPS				23			/**< The amount of DSMX hops */
+#define LINKSTATS_RSSI_BINS			8			/**< The RSSI histogram bins (4 RSSI steps each) */
+#define LINKSTATS_JITTER_BINS		8			/**< The jitter histogram bins (powers of two of 10 microseconds) */
+#define LINKSTATS_INTERVAL			1000		/**< The interval between the link statistics records in ms */
+
+/**
+ * The link statistics of one hop, this is also the capture record
+ */
+struct LinkStatsHop {
+	uint8_t hop;								/**< The hop index */
+	uint8_t channel;							/**< The last RF channel of this hop */
+	uint16_t received;							/**< The received packets */
+	uint16_t bad_crc;							/**< The packets received with a bad (inverted) CRC, or rejected by the software CRC */
+	uint16_t timeouts;							/**< The packets missed */
+	uint16_t rssi[LINKSTATS_RSSI_BINS];			/**< The RSSI histogram */
+	uint16_t jitter[LINKSTATS_JITTER_BINS];		/**< The arrival jitter histogram */
+	uint16_t last_arrival;						/**< The last arrival time after the timer was set in 10 microseconds */
+} __attribute__((packed));
+
+/* External functions */
+void linkstats_reset(void);
+void linkstats_receive(uint8_t hop, uint8_t channel, uint8_t rssi, uint8_t rx_status, uint16_t arrival);
+void linkstats_timeout(uint8_t hop);
+void linkstats_crc_error(uint8_t hop);
+void linkstats_run(void);
+
+#endif /* MODULES_LINKSTATS_H_ */
@@ -0,0 +1,108 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "prof.h"
+#include "timer.h"
+#include "ramfunc.h"
+
+/* The zones and the time of the last reset */
+static struct ProfZone prof_zones[PROF_ZONE_NB];
+static uint32_t prof_reset_time = 0;
+
+/* The latency histograms */
+static struct ProfLatency prof_latencies[PROF_LAT_NB];
+
+/* The zone names used in the report */
+const char *prof_zone_names[PROF_ZONE_NB] = {
+	[PROF_CYRF_IRQ]		= "cyrf_irq",
+	[PROF_CYRF_SEND]	= "cyrf_send",
+	[PROF_CYRF_RECV]	= "cyrf_recv",
+	[PROF_TIMER_DSM]	= "timer_dsm",
+	[PROF_WORK]			= "work",
+};
+const char *prof_latency_names[PROF_LAT_NB] = {
+	[PROF_LAT_TIMER_DSM]	= "timer_dsm",
+	[PROF_LAT_CYRF_IRQ]		= "cyrf_irq",
+};
+
+/**
+ * Add a run of a zone, called at the end of the zone with the interrupts of the zone itself blocked
+ * @param[in] zone The zone
+ * @param[in] cycles The cycles the zone took
+ */
+void RAMFUNC prof_add(enum prof_zone zone, uint32_t cycles) {
+	struct ProfZone *z = &prof_zones[zone];
+
+	if (z->count == 0 || cycles < z->min)
+		z->min = cycles;
+	if (cycles > z->max)
+		z->max = cycles;
+	z->sum += cycles;
+	z->count++;
+}
+
+/**
+ * Copy and reset the zones
+ * @param[out] zones The zones since the last reset
+ * @return The time since the last reset in 10 microseconds
+ */
+uint32_t prof_take(struct ProfZone zones[PROF_ZONE_NB]) {
+	uint32_t mask = cm_mask_interrupts(1);
+	uint32_t now = timer_get_time();
+	uint32_t elapsed = now - prof_reset_time;
+
+	memcpy(zones, prof_zones, sizeof(prof_zones));
+	memset(prof_zones, 0, sizeof(prof_zones));
+	prof_reset_time = now;
+	cm_mask_interrupts(mask);
+
+	return elapsed;
+}
+
+/**
+ * Add the latency of an interrupt, called at the entry of the interrupt
+ * @param[in] lat The interrupt
+ * @param[in] cycles The CPU cycles between the hardware event and the entry
+ */
+void RAMFUNC prof_latency(enum prof_latency lat, uint32_t cycles) {
+	struct ProfLatency *l = &prof_latencies[lat];
+	uint8_t bin = 0;
+
+	while (bin < PROF_LAT_BINS - 1 && (cycles >> (PROF_LAT_SHIFT + bin)) != 0)
+		bin++;
+	l->bins[bin]++;
+	if (cycles > l->max)
+		l->max = cycles;
+}
+
+/**
+ * Copy and reset the latency histograms
+ * @param[out] latency The histograms since the last reset
+ */
+void prof_take_latency(struct ProfLatency latency[PROF_LAT_NB]) {
+	uint32_t mask = cm_mask_interrupts(1);
+
+	memcpy(latency, prof_latencies, sizeof(prof_latencies));
+	memset(prof_latencies, 0, sizeof(prof_latencies));
+	cm_mask_interrupts(mask);
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MODULES_PROF_H_
+#define MODULES_PROF_H_
+
+#include <libopencm3/cm3/common.h>
+#include <libopencm3/cm3/dwt.h>
+
+#ifndef PROF_ENABLE
+#define PROF_ENABLE				1			/**< Whether the profiling zones are compiled in */
+#endif
+
+/**
+ * The profiling zones
+ */
+enum prof_zone {
+	PROF_CYRF_IRQ			= 0,			/**< The complete CYRF interrupt */
+	PROF_CYRF_SEND,							/**< The protocol send callback */
+	PROF_CYRF_RECV,							/**< The protocol receive callback */
+	PROF_TIMER_DSM,							/**< The complete DSM timer interrupt with the protocol callback */
+	PROF_WORK,								/**< The work that runs in the PendSV */
+	PROF_ZONE_NB							/**< The amount of zones */
+};
+
+/**
+ * The statistics of one zone since the last reset
+ */
+struct ProfZone {
+	uint32_t count;							/**< The amount of times the zone was run */
+	uint32_t min;							/**< The minimum cycles */
+	uint32_t max;							/**< The maximum cycles */
+	uint64_t sum;							/**< The total cycles */
+};
+
+/**
+ * The interrupts of which the latency from the hardware event is measured
+ */
+enum prof_latency {
+	PROF_LAT_TIMER_DSM		= 0,			/**< The start of the DSM timer compare tick against the cycles at entry */
+	PROF_LAT_CYRF_IRQ,						/**< The start of the captured CYRF IRQ edge tick against the cycles at entry (up to 720 cycles high) */
+	PROF_LAT_NB								/**< The amount of measured interrupts */
+};
+#define PROF_LAT_BINS			8			/**< The histogram bins, below 32, 32-63, 64-127, .. and 2048 or more cycles */
+#define PROF_LAT_SHIFT			5			/**< The first bin is below 1 << PROF_LAT_SHIFT cycles */
+
+/**
+ * The latency histogram of one interrupt since the last reset
+ */
+struct ProfLatency {
+	uint32_t bins[PROF_LAT_BINS];			/**< The amount of interrupts per bin */
+	uint32_t max;							/**< The maximum latency in cycles */
+};
+
+/* Mark the start and end of a zone within one function, this only costs a few cycles */
+#if PROF_ENABLE
+#define PROF_ENTER(zone)		uint32_t prof_start_ ## zone = DWT_CYCCNT
+#define PROF_EXIT(zone)			prof_add(zone, DWT_CYCCNT - prof_start_ ## zone)
+#else
+#define PROF_ENTER(zone)
+#define PROF_EXIT(zone)
+#endif
+
+/* External functions */
+extern const char *prof_zone_names[PROF_ZONE_NB];
+void prof_add(enum prof_zone zone, uint32_t cycles);
+uint32_t prof_take(struct ProfZone zones[PROF_ZONE_NB]);
+extern const char *prof_latency_names[PROF_LAT_NB];
+void prof_latency(enum prof_latency lat, uint32_t cycles);
+void prof_take_latency(struct ProfLatency latency[PROF_LAT_NB]);
+
+#endif /* MODULES_PROF_H_ */
@@ -0,0 +1,37 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <libopencm3/cm3/common.h>
+
+#include "ramfunc.h"
+
+/* The RAM functions and their load image in flash, from the linker script */
+extern uint32_t _ramfunc, _eramfunc, _ramfunc_loadaddr;
+
+/**
+ * Copy the RAM functions from flash, before any of them is used
+ */
+void ramfunc_init(void) {
+	volatile uint32_t *src = &_ramfunc_loadaddr;
+	volatile uint32_t *dest = &_ramfunc;
+
+	while (dest < &_eramfunc)
+		*dest++ = *src++;
+}
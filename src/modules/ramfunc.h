@@ -0,0 +1,39 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MODULES_RAMFUNC_H_
+#define MODULES_RAMFUNC_H_
+
+#ifndef RAMFUNC_ENABLE
+#define RAMFUNC_ENABLE			1			/**< Whether the radio hot path runs from RAM */
+#endif
+
+/* Place a function in RAM, so it runs without the flash wait states (never inlined into a flash function,
+ * the RAM functions inline the register accessors from cyrf6936.h instead) */
+#if RAMFUNC_ENABLE
+#define RAMFUNC					__attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+/* External functions */
+void ramfunc_init(void);
+
+#endif /* MODULES_RAMFUNC_H_ */
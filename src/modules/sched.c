@@ -0,0 +1,148 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "sched.h"
+#include "config.h"
+#include "timer.h"
+
+/* The scheduler state */
+volatile uint32_t sched_ticks = 0;
+static volatile uint32_t sched_events = 0;
+static uint32_t sched_idle = 0;					/**< The idle time in 10 microseconds in this report interval */
+static uint32_t sched_report_ticks = 0;			/**< The tick of the last report */
+
+/**
+ * Initialize the scheduler and its 1 kHz timer
+ */
+void sched_init(void) {
+	int i;
+
+	for (i = 0; i < SCHED_TASK_NB; i++) {
+		sched_tasks[i].next_run = sched_tasks[i].period;
+		sched_tasks[i].runs = 0;
+		sched_tasks[i].wcet = 0;
+	}
+
+	// Setup the SysTick at 1 kHz (72MHz / 72000)
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
+	systick_set_reload(72000000 / SCHED_TICK_FREQ - 1);
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+/**
+ * Signal a task to run, can be called from interrupts
+ * @param[in] id The task
+ */
+void sched_event(enum sched_task_id id) {
+	uint32_t mask = cm_mask_interrupts(1);
+	sched_events |= (1 << id);
+	cm_mask_interrupts(mask);
+}
+
+/**
+ * Change the period of a task
+ * @param[in] id The task
+ * @param[in] period The new period in ticks (0 to disable)
+ */
+void sched_set_period(enum sched_task_id id, uint16_t period) {
+	uint32_t mask = cm_mask_interrupts(1);
+	sched_tasks[id].period = period;
+	sched_tasks[id].next_run = sched_ticks + period;
+	cm_mask_interrupts(mask);
+}
+
+/**
+ * The scheduler loop, this never returns
+ */
+void sched_run(void) {
+	uint32_t events, start, cycles;
+	uint16_t idle_start;
+	int i;
+
+	while (1) {
+		// Take the events or sleep until an interrupt happens
+		cm_disable_interrupts();
+		events = sched_events;
+		sched_events = 0;
+		if (events == 0) {
+			idle_start = timer_get_ticks();
+			__asm__ volatile ("wfi");
+			sched_idle += (uint16_t)(timer_get_ticks() - idle_start);
+		}
+		cm_enable_interrupts();
+
+		// Run the ready tasks to completion
+		for (i = 0; i < SCHED_TASK_NB; i++) {
+			if (!(events & (1 << i)))
+				continue;
+
+			start = timer_get_cycles();
+			sched_tasks[i].func();
+			cycles = timer_get_cycles() - start;
+
+			sched_tasks[i].runs++;
+			if (cycles > sched_tasks[i].wcet)
+				sched_tasks[i].wcet = cycles;
+		}
+	}
+}
+
+/**
+ * Report the idle percentage and the task execution times over the CDCACM
+ */
+void sched_report(void) {
+	uint32_t interval = sched_ticks - sched_report_ticks;
+	uint32_t idle = sched_idle;
+	int i;
+
+	sched_idle = 0;
+	sched_report_ticks = sched_ticks;
+	if (interval == 0)
+		return;
+
+	// The idle time is in 10 microseconds and the interval in milliseconds
+	DEBUG(sched, "Idle %u.%u%% over %ums", (unsigned int)(idle / interval), (unsigned int)((idle * 10 / interval) % 10), (unsigned int)interval);
+	for (i = 0; i < SCHED_TASK_NB; i++) {
+		DEBUG(sched, "Task %s: %u runs, wcet %uus", sched_tasks[i].name, (unsigned int)sched_tasks[i].runs,
+				(unsigned int)(sched_tasks[i].wcet / 72));
+		sched_tasks[i].runs = 0;
+		sched_tasks[i].wcet = 0;
+	}
+}
+
+/**
+ * The SysTick handler which starts the periodic tasks
+ */
+void sys_tick_handler(void) {
+	int i;
+
+	sched_ticks++;
+	for (i = 0; i < SCHED_TASK_NB; i++) {
+		if (sched_tasks[i].period != 0 && (int32_t)(sched_ticks - sched_tasks[i].next_run) >= 0) {
+			sched_tasks[i].next_run += sched_tasks[i].period;
+			sched_events |= (1 << i);
+		}
+	}
+}
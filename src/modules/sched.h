@@ -0,0 +1,65 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MODULES_SCHED_H_
+#define MODULES_SCHED_H_
+
+#include <libopencm3/cm3/common.h>
+
+#define SCHED_TICK_FREQ			1000		/**< The scheduler timer frequency in Hz */
+#define SCHED_REPORT_INTERVAL	5000		/**< The interval of the scheduler report in ticks */
+
+/**
+ * The scheduler tasks, a lower id runs first when multiple tasks are ready
+ */
+enum sched_task_id {
+	SCHED_TASK_USB			= 0,			/**< Handle the USB events */
+	SCHED_TASK_PROTOCOL,					/**< Start the protocol after boot */
+	SCHED_TASK_CONFIG,						/**< Write the config to flash */
+	SCHED_TASK_CAPTURE,						/**< Send the capture statistics */
+	SCHED_TASK_LINKSTATS,					/**< Send the link quality statistics */
+	SCHED_TASK_LED,							/**< Animate the leds */
+	SCHED_TASK_STATS,						/**< Report the scheduler statistics */
+	SCHED_TASK_NB							/**< The amount of tasks */
+};
+
+/**
+ * A run to completion task, started by an event or its period
+ */
+struct SchedTask {
+	const char *name;						/**< The name used in the report */
+	void (*func)(void);						/**< The task function */
+	uint16_t period;						/**< The period in ticks (0 when only started by events) */
+
+	uint32_t next_run;						/**< The tick of the next periodic run */
+	uint32_t runs;							/**< The amount of runs in this report interval */
+	uint32_t wcet;							/**< The worst case execution time in cycles in this report interval */
+};
+
+/* External functions */
+extern struct SchedTask sched_tasks[SCHED_TASK_NB];
+extern volatile uint32_t sched_ticks;
+void sched_init(void);
+void sched_event(enum sched_task_id id);
+void sched_set_period(enum sched_task_id id, uint16_t period);
+void sched_run(void);
+void sched_report(void);
+
+#endif /* MODULES_SCHED_H_ */
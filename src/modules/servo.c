@@ -0,0 +1,327 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/f1/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "servo.h"
+#include "config.h"
+#include "../helper/crc.h"
+
+#define SERVO_US_CENTER				1500		/**< The servo center pulse width for unknown channels */
+#define SERVO_SBUS_HEADER			0x0F		/**< The SBUS start byte */
+#define SERVO_SBUS_FRAME_LOST		(1<<2)		/**< The SBUS frame lost flag */
+#define SERVO_SBUS_FAILSAFE			(1<<3)		/**< The SBUS failsafe flag */
+#define SERVO_SRXL_HEADER			0xA1		/**< The SRXL (12 channel) start byte */
+
+#ifdef USE_SERVO_PPM
+static uint16_t servo_ppm_us[SERVO_PPM_MAX_CHANNELS];		/**< The channels of the running PPM train */
+static uint16_t servo_ppm_next_us[SERVO_PPM_MAX_CHANNELS];	/**< The channels of the next PPM train */
+static uint8_t servo_ppm_nb_channels;						/**< The amount of channels in the running PPM train */
+static uint8_t servo_ppm_next_nb_channels;					/**< The amount of channels in the next PPM train */
+static uint8_t servo_ppm_idx;								/**< The next PPM slot */
+static bool servo_ppm_pending = false;						/**< When there is a next PPM train */
+static bool servo_ppm_running = false;						/**< When the PPM timer is running */
+#endif
+
+#ifdef USE_SERVO_SERIAL
+static uint8_t servo_serial_buffer[SERVO_SRXL_LENGTH];		/**< The DMA buffer of the serial output */
+#endif
+
+/**
+ * Get the pulse width of a channel limited to the servo range
+ * @param[in] frame The servo channel frame
+ * @param[in] chan The channel number
+ * @return The pulse width in microseconds
+ */
+static uint16_t servo_channel_us(const struct ChannelFrame *frame, uint8_t chan) {
+	uint16_t us = (chan < frame->nb_channels)? frame->us[chan] : 0;
+
+	if (us == 0)
+		return SERVO_US_CENTER;
+	if (us < SERVO_US_MIN)
+		return SERVO_US_MIN;
+	if (us > SERVO_US_MAX)
+		return SERVO_US_MAX;
+	return us;
+}
+
+#ifdef USE_SERVO_PPM
+/**
+ * Initialize the PPM output
+ * Every slot is high with the separation pulse low at the end, so a stopped timer keeps the line idle high.
+ */
+static void servo_ppm_init(void) {
+	rcc_peripheral_enable_clock(&RCC_APB1ENR, SERVO_PPM_TIMER_CLK);
+	rcc_peripheral_enable_clock(&RCC_APB2ENR, SERVO_PPM_GPIO_CLK);
+	gpio_set_mode(SERVO_PPM_GPIO_PORT, GPIO_MODE_OUTPUT_50_MHZ,
+			GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, SERVO_PPM_GPIO_PIN);
+
+	// Enable the timer NVIC below the DSM timer and the CYRF, the STM32 only uses the upper 4 priority bits
+	nvic_enable_irq(SERVO_PPM_NVIC);
+	nvic_set_priority(SERVO_PPM_NVIC, 0x20);
+
+	// Setup the timer
+	timer_disable_counter(SERVO_PPM_TIMER);
+	timer_reset(SERVO_PPM_TIMER);
+	timer_set_mode(SERVO_PPM_TIMER, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	timer_disable_preload(SERVO_PPM_TIMER);
+	timer_continuous_mode(SERVO_PPM_TIMER);
+
+	// Set timer updates each microsecond
+	timer_set_prescaler(SERVO_PPM_TIMER, 72 - 1);
+	timer_set_period(SERVO_PPM_TIMER, 65535);
+
+	// The output is high while the counter is below the compare value
+	timer_disable_oc_preload(SERVO_PPM_TIMER, SERVO_PPM_OC);
+	timer_set_oc_mode(SERVO_PPM_TIMER, SERVO_PPM_OC, TIM_OCM_PWM1);
+	timer_set_oc_polarity_high(SERVO_PPM_TIMER, SERVO_PPM_OC);
+	timer_set_oc_value(SERVO_PPM_TIMER, SERVO_PPM_OC, 65535);
+	timer_enable_oc_output(SERVO_PPM_TIMER, SERVO_PPM_OC);
+
+	// Interrupt at the start of every slot
+	timer_enable_irq(SERVO_PPM_TIMER, TIM_DIER_UIE);
+}
+
+/**
+ * Set the length of the current PPM slot
+ * @param[in] length The length of the slot in microseconds
+ * @param[in] pulse The length of the separation pulse at the end of the slot
+ */
+static void servo_ppm_slot(uint16_t length, uint16_t pulse) {
+	timer_set_period(SERVO_PPM_TIMER, length - 1);
+	timer_set_oc_value(SERVO_PPM_TIMER, SERVO_PPM_OC, length - pulse);
+}
+
+/**
+ * Load the next PPM train and start with the leading separation pulse
+ */
+static void servo_ppm_load(void) {
+	memcpy(servo_ppm_us, servo_ppm_next_us, sizeof(servo_ppm_us));
+	servo_ppm_nb_channels = servo_ppm_next_nb_channels;
+	servo_ppm_pending = false;
+
+	servo_ppm_idx = 0;
+	servo_ppm_slot(2 * SERVO_PPM_PULSE, SERVO_PPM_PULSE);
+}
+
+/**
+ * Queue a frame for the PPM output, it starts directly when the output is idle
+ * @param[in] frame The servo channel frame
+ */
+static void servo_ppm_frame(const struct ChannelFrame *frame) {
+	uint32_t mask;
+	uint8_t i;
+
+	// The PPM timer interrupt loads the train, so it must not see it half way
+	mask = cm_mask_interrupts(1);
+	servo_ppm_next_nb_channels = (frame->nb_channels > SERVO_PPM_MAX_CHANNELS)? SERVO_PPM_MAX_CHANNELS : frame->nb_channels;
+	for (i = 0; i < servo_ppm_next_nb_channels; i++)
+		servo_ppm_next_us[i] = servo_channel_us(frame, i);
+	servo_ppm_pending = true;
+
+	// Start the train directly when idle, so the output is locked to the packet arrival
+	if (!servo_ppm_running) {
+		servo_ppm_running = true;
+		servo_ppm_load();
+		timer_set_counter(SERVO_PPM_TIMER, 0);
+		timer_enable_counter(SERVO_PPM_TIMER);
+	}
+	cm_mask_interrupts(mask);
+}
+
+/**
+ * The PPM timer interrupt handler, at the start of every slot
+ */
+void SERVO_PPM_IRQ(void) {
+	timer_clear_flag(SERVO_PPM_TIMER, TIM_SR_UIF);
+
+	if (servo_ppm_idx < servo_ppm_nb_channels) {
+		// Output the next channel
+		servo_ppm_slot(servo_ppm_us[servo_ppm_idx], SERVO_PPM_PULSE);
+	} else if (servo_ppm_idx == servo_ppm_nb_channels) {
+		// Output the minimum sync gap without pulse
+		servo_ppm_slot(SERVO_PPM_SYNC, 0);
+	} else if (servo_ppm_pending) {
+		// Start with the next train
+		servo_ppm_load();
+		return;
+	} else {
+		// Stop with the line idle high until the next frame
+		timer_disable_counter(SERVO_PPM_TIMER);
+		servo_ppm_running = false;
+		return;
+	}
+
+	servo_ppm_idx++;
+}
+#endif
+
+#ifdef USE_SERVO_SERIAL
+/**
+ * Initialize the serial output for SBUS or SRXL
+ */
+static void servo_serial_init(void) {
+	rcc_peripheral_enable_clock(&RCC_APB1ENR, SERVO_SERIAL_USART_CLK);
+	rcc_peripheral_enable_clock(&RCC_APB2ENR, SERVO_SERIAL_GPIO_CLK);
+	rcc_peripheral_enable_clock(&RCC_AHBENR, RCC_AHBENR_DMA1EN);
+	gpio_set_mode(SERVO_SERIAL_GPIO_PORT, GPIO_MODE_OUTPUT_50_MHZ,
+			GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, SERVO_SERIAL_GPIO_PIN);
+
+	// SBUS is 100000 baud 8E2 (9 bits with parity), SRXL is 115200 baud 8N1
+	if (usbrf_config.servo_serial == SERVO_SERIAL_SBUS) {
+		usart_set_baudrate(SERVO_SERIAL_USART, 100000);
+		usart_set_databits(SERVO_SERIAL_USART, 9);
+		usart_set_stopbits(SERVO_SERIAL_USART, USART_STOPBITS_2);
+		usart_set_parity(SERVO_SERIAL_USART, USART_PARITY_EVEN);
+	} else {
+		usart_set_baudrate(SERVO_SERIAL_USART, 115200);
+		usart_set_databits(SERVO_SERIAL_USART, 8);
+		usart_set_stopbits(SERVO_SERIAL_USART, USART_STOPBITS_1);
+		usart_set_parity(SERVO_SERIAL_USART, USART_PARITY_NONE);
+	}
+	usart_set_mode(SERVO_SERIAL_USART, USART_MODE_TX);
+	usart_set_flow_control(SERVO_SERIAL_USART, USART_FLOWCONTROL_NONE);
+	usart_enable_tx_dma(SERVO_SERIAL_USART);
+	usart_enable(SERVO_SERIAL_USART);
+}
+
+/**
+ * Check if the serial output is still sending the previous frame
+ */
+static bool servo_serial_busy(void) {
+	return DMA_CNDTR(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL) != 0;
+}
+
+/**
+ * Send the serial output buffer with DMA
+ * @param[in] length The length of the frame in the buffer
+ */
+static void servo_serial_send(uint8_t length) {
+	dma_channel_reset(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL);
+	dma_set_peripheral_address(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL, (uint32_t)&USART_DR(SERVO_SERIAL_USART));
+	dma_set_memory_address(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL, (uint32_t)servo_serial_buffer);
+	dma_set_number_of_data(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL, length);
+	dma_set_read_from_memory(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL);
+	dma_enable_memory_increment_mode(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL);
+	dma_set_peripheral_size(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL, DMA_CCR_PL_HIGH);
+	dma_enable_channel(SERVO_SERIAL_DMA, SERVO_SERIAL_DMA_CHANNEL);
+}
+#endif
+
+/**
+ * Initialize the servo outputs
+ */
+void servo_init(void) {
+#ifdef USE_SERVO_PPM
+	if (usbrf_config.servo_ppm_enable)
+		servo_ppm_init();
+#endif
+#ifdef USE_SERVO_SERIAL
+	if (usbrf_config.servo_serial != SERVO_SERIAL_NONE)
+		servo_serial_init();
+#endif
+}
+
+/**
+ * Output a servo channel frame on all enabled outputs
+ * This is called directly after a packet is decoded, so the outputs are locked to the packet arrival.
+ * @param[in] frame The servo channel frame
+ */
+void servo_output(const struct ChannelFrame *frame) {
+#ifdef USE_SERVO_PPM
+	if (usbrf_config.servo_ppm_enable)
+		servo_ppm_frame(frame);
+#endif
+#ifdef USE_SERVO_SERIAL
+	// Drop the frame when the previous one is still being sent
+	if (usbrf_config.servo_serial == SERVO_SERIAL_NONE || servo_serial_busy())
+		return;
+
+	if (usbrf_config.servo_serial == SERVO_SERIAL_SBUS)
+		servo_serial_send(servo_encode_sbus(frame, servo_serial_buffer));
+	else
+		servo_serial_send(servo_encode_srxl(frame, servo_serial_buffer));
+#else
+	(void) frame;
+#endif
+}
+
+/**
+ * Encode a servo channel frame as SBUS frame
+ * @param[in] frame The servo channel frame
+ * @param[out] data The SBUS frame of SERVO_SBUS_LENGTH bytes
+ * @return The length of the SBUS frame
+ */
+uint8_t servo_encode_sbus(const struct ChannelFrame *frame, uint8_t *data) {
+	uint8_t i, idx = 1, nb_bits = 0;
+	uint32_t bits = 0;
+
+	data[0] = SERVO_SBUS_HEADER;
+
+	// Pack the 16 channels of 11 bits LSB first
+	for (i = 0; i < SERVO_SBUS_CHANNELS; i++) {
+		int32_t value = ((servo_channel_us(frame, i) - 880) * 8) / 5;
+		value = (value < 0)? 0 : (value > 0x07FF)? 0x07FF : value;
+
+		bits |= (uint32_t)value << nb_bits;
+		nb_bits += 11;
+		while (nb_bits >= 8) {
+			data[idx++] = bits & 0xFF;
+			bits >>= 8;
+			nb_bits -= 8;
+		}
+	}
+
+	data[23] = frame->failsafe? (SERVO_SBUS_FRAME_LOST | SERVO_SBUS_FAILSAFE) : 0x00;
+	data[24] = 0x00;
+	return SERVO_SBUS_LENGTH;
+}
+
+/**
+ * Encode a servo channel frame as SRXL (12 channel) frame
+ * @param[in] frame The servo channel frame
+ * @param[out] data The SRXL frame of SERVO_SRXL_LENGTH bytes
+ * @return The length of the SRXL frame
+ */
+uint8_t servo_encode_srxl(const struct ChannelFrame *frame, uint8_t *data) {
+	uint8_t i;
+	uint16_t crc;
+
+	data[0] = SERVO_SRXL_HEADER;
+
+	// 12 channels of 12 bits (800us - 2200us) big endian
+	for (i = 0; i < SERVO_SRXL_CHANNELS; i++) {
+		const uint16_t value = ((uint32_t)(servo_channel_us(frame, i) - SERVO_US_MIN) * 0x0FFF) / (SERVO_US_MAX - SERVO_US_MIN);
+		data[1 + 2*i] = value >> 8;
+		data[2 + 2*i] = value & 0xFF;
+	}
+
+	crc = crc16_ccitt(0x0000, data, SERVO_SRXL_LENGTH - 2);
+	data[SERVO_SRXL_LENGTH - 2] = crc >> 8;
+	data[SERVO_SRXL_LENGTH - 1] = crc & 0xFF;
+	return SERVO_SRXL_LENGTH;
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_SERVO_H_
+#define MODULES_SERVO_H_
+
+// Include the board specifications for the servo outputs
+#include "../board.h"
+#include "../helper/convert.h"
+
+/* The serial servo output protocols */
+enum servo_serial {
+	SERVO_SERIAL_NONE			= 0x0,			/**< No serial servo output */
+	SERVO_SERIAL_SBUS			= 0x1,			/**< Futaba SBUS (100000 baud, 8E2, needs an external inverter) */
+	SERVO_SERIAL_SRXL			= 0x2,			/**< Multiplex SRXL with 12 channels (115200 baud, 8N1) */
+};
+
+#define SERVO_PPM_MAX_CHANNELS		8			/**< The maximum amount of channels in the PPM train */
+#define SERVO_PPM_PULSE				300			/**< The PPM separation pulse in microseconds */
+#define SERVO_PPM_SYNC				4000		/**< The minimum PPM sync gap in microseconds */
+#define SERVO_US_MIN				800			/**< The minimum servo pulse width in microseconds */
+#define SERVO_US_MAX				2200		/**< The maximum servo pulse width in microseconds */
+
+#define SERVO_SBUS_LENGTH			25			/**< The length of an SBUS frame */
+#define SERVO_SBUS_CHANNELS			16			/**< The amount of channels in an SBUS frame */
+#define SERVO_SRXL_LENGTH			27			/**< The length of an SRXL frame */
+#define SERVO_SRXL_CHANNELS			12			/**< The amount of channels in an SRXL frame */
+
+/* External functions */
+void servo_init(void);
+void servo_output(const struct ChannelFrame *frame);
+uint8_t servo_encode_sbus(const struct ChannelFrame *frame, uint8_t *data);
+uint8_t servo_encode_srxl(const struct ChannelFrame *frame, uint8_t *data);
+
+#endif /* MODULES_SERVO_H_ */
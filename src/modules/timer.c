@@ -22,14 +22,28 @@
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/f1/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/scs.h>
+#include <libopencm3/cm3/dwt.h>
 
 #include "timer.h"
 #include "config.h"
+#include "prof.h"
+#include "ramfunc.h"
 
 /* The timer callbacks */
 timer_on_event _timer_dsm_on_event = NULL;
 uint16_t timer_dsm_value;
 
+/* The extended timer time */
+static uint16_t timer_time_last = 0;
+static uint32_t timer_time_high = 0;
+
+/* The DWT cycles at the start of a DSM timer tick, both run from the 72MHz clock */
+static uint32_t timer_tick_cycles = 0;
+static uint16_t timer_tick_count = 0;
+static uint32_t timer_tick_period = 720;
+
 /**
  * Initialize the DSM timer
  */
@@ -56,22 +70,100 @@ static void timer_dsm_init(void) {
 	timer_set_oc_slow_mode(TIMER_DSM, TIM_OC1);
 	timer_set_oc_mode(TIMER_DSM, TIM_OC1, TIM_OCM_FROZEN);
 
+#if CYRF_DEV_IRQ_CAPTURE == 4
+	// Capture the falling edge of the CYRF IRQ for the interrupt latency
+	TIM_CCMR2(TIMER_DSM) |= TIM_CCMR2_CC4S_IN_TI4;
+	TIM_CCER(TIMER_DSM) |= TIM_CCER_CC4P | TIM_CCER_CC4E;
+#endif
+
 	// Set timer updates each 10 microseconds
 	timer_set_prescaler(TIMER_DSM, (720*usbrf_config.timer_scaler) - 1);
 	timer_set_period(TIMER_DSM, 65535);
 
 	// Start the timer
 	timer_enable_counter(TIMER_DSM);
+
+	// Take the cycle counter at the start of a tick, so the hardware events on the timer can be converted to cycles
+	timer_tick_period = 720 * usbrf_config.timer_scaler;
+	timer_tick_count = timer_get_counter(TIMER_DSM);
+	while (timer_get_counter(TIMER_DSM) == timer_tick_count);
+	timer_tick_cycles = DWT_CYCCNT;
+	timer_tick_count++;
+}
+
+/**
+ * Get the cycles since the start of a DSM timer tick, with interrupts blocked
+ * The reference tick is moved along, so it needs to be called at least every 59 seconds
+ * @param[in] tick The timer tick, at most 65535 ticks ago
+ * @return The CPU cycles since the start of the tick
+ */
+static uint32_t RAMFUNC timer_cycles_since_tick(uint16_t tick) {
+	uint32_t elapsed = DWT_CYCCNT - timer_tick_cycles;
+	uint32_t ticks = elapsed / timer_tick_period;
+
+	timer_tick_cycles += ticks * timer_tick_period;
+	timer_tick_count += ticks;
+	return (uint16_t)(timer_tick_count - tick) * timer_tick_period + (elapsed - ticks * timer_tick_period);
 }
 
 /**
  * Initialize the timers
  */
 void timer_init(void) {
+	// The cycle counter is the reference of the DSM timer latency
+	timer_cycles_init();
+
 	// Initialize the DSM timer
 	timer_dsm_init();
 }
 
+/**
+ * Get the free running timer ticks
+ * @return The timer counter in steps of 10 microseconds
+ */
+uint16_t timer_get_ticks(void) {
+	return timer_get_counter(TIMER_DSM);
+}
+
+/**
+ * Enable the DWT cycle counter
+ */
+void timer_cycles_init(void) {
+	SCS_DEMCR |= SCS_DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+/**
+ * Get the DWT cycle counter
+ * @return The CPU cycles (72 per microsecond)
+ */
+uint32_t timer_get_cycles(void) {
+	return DWT_CYCCNT;
+}
+
+/**
+ * Get the extended timer time, needs to be called at least every 655ms
+ * @return The time since boot in steps of 10 microseconds
+ */
+uint32_t timer_get_time(void) {
+	uint32_t mask = cm_mask_interrupts(1);
+	uint16_t ticks = timer_get_counter(TIMER_DSM);
+	uint32_t time;
+
+	// Check for an overflow of the 16 bit counter
+	if(ticks < timer_time_last)
+		timer_time_high += 0x10000;
+	timer_time_last = ticks;
+
+	time = timer_time_high | ticks;
+
+	// Keep the cycle reference of the ticks within the range of the cycle counter
+	timer_cycles_since_tick(ticks);
+	cm_mask_interrupts(mask);
+	return time;
+}
+
 /**
  * Set the DSM timer to interrupt
  * @param[in] us The time in microseconds divided by 10
@@ -118,11 +210,28 @@ void timer_dsm_register_callback(timer_on_event callback) {
 /**
  * The timer interrupt handler
  */
-void TIMER_DSM_IRQ(void) {
+void RAMFUNC TIMER_DSM_IRQ(void) {
+	prof_latency(PROF_LAT_TIMER_DSM, timer_cycles_since_tick(TIM_CCR1(TIMER_DSM)));
+	PROF_ENTER(PROF_TIMER_DSM);
+
 	// Stop the timer
 	timer_dsm_stop();
 
 	// Callback
 	if (_timer_dsm_on_event != NULL)
 		_timer_dsm_on_event();
+	PROF_EXIT(PROF_TIMER_DSM);
+}
+
+/**
+ * Get the cycles since the last CYRF IRQ edge, called from the CYRF interrupt
+ * The edge is captured in a 10 microsecond tick, so this is up to one tick (720 cycles) more than the real age
+ * @return The CPU cycles since the start of the captured tick (0 when the board can't capture the edge)
+ */
+uint32_t RAMFUNC timer_cyrf_irq_age(void) {
+#if CYRF_DEV_IRQ_CAPTURE == 4
+	return timer_cycles_since_tick(TIM_CCR4(TIMER_DSM));
+#else
+	return 0;
+#endif
 }
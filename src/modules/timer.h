@@ -26,9 +26,14 @@
 /* External functions */
 typedef void (*timer_on_event) (void);
 void timer_init(void);
+uint16_t timer_get_ticks(void);
+uint32_t timer_get_time(void);
+void timer_cycles_init(void);
+uint32_t timer_get_cycles(void);
 void timer_dsm_set(uint16_t us);
 uint16_t timer_dsm_get_time(void);
 void timer_dsm_stop(void);
 void timer_dsm_register_callback(timer_on_event callback);
+uint32_t timer_cyrf_irq_age(void);
 
 #endif /* MODULES_TIMER_H_ */
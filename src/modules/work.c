@@ -0,0 +1,134 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "work.h"
+#include "prof.h"
+
+/**
+ * The pending work of one priority
+ */
+struct WorkQueue {
+	work_func funcs[WORK_QUEUE_SIZE];		/**< The pending work */
+	uint8_t insert_idx;						/**< The insert index */
+	uint8_t extract_idx;					/**< The extract index */
+	uint8_t count;							/**< The amount of pending work */
+};
+
+static struct WorkQueue work_queues[WORK_PRIO_NB];
+uint32_t work_dropped = 0;
+uint8_t work_max_pending = 0;
+
+/**
+ * Initialize the work queue
+ * The work runs in the PendSV handler at the lowest interrupt priority, so it
+ * preempts the main loop but never delays the radio and timer interrupts.
+ */
+void work_init(void) {
+	int i;
+
+	for (i = 0; i < WORK_PRIO_NB; i++) {
+		work_queues[i].insert_idx = 0;
+		work_queues[i].extract_idx = 0;
+		work_queues[i].count = 0;
+	}
+
+	// Set the PendSV (exception 14) to the lowest priority
+	SCB_SHPR(14 - 4) = 0xFF;
+}
+
+/**
+ * Post work from an interrupt, the same work is only queued once
+ * @param[in] func The work function
+ * @param[in] prio The priority of the work
+ * @return False when the queue was full and the work is dropped
+ */
+bool work_post(work_func func, enum work_priority prio) {
+	struct WorkQueue *queue = &work_queues[prio];
+	uint32_t mask = cm_mask_interrupts(1);
+	uint8_t i;
+
+	// Check if the work is already pending
+	for (i = 0; i < queue->count; i++) {
+		if (queue->funcs[(queue->extract_idx + i) % WORK_QUEUE_SIZE] == func) {
+			cm_mask_interrupts(mask);
+			return true;
+		}
+	}
+
+	// Check if there is space left
+	if (queue->count >= WORK_QUEUE_SIZE) {
+		work_dropped++;
+		cm_mask_interrupts(mask);
+		return false;
+	}
+
+	queue->funcs[queue->insert_idx] = func;
+	queue->insert_idx = (queue->insert_idx + 1) % WORK_QUEUE_SIZE;
+	queue->count++;
+	if (queue->count > work_max_pending)
+		work_max_pending = queue->count;
+	cm_mask_interrupts(mask);
+
+	// Run the work as soon as the interrupts are done
+	SCB_ICSR = SCB_ICSR_PENDSVSET;
+	return true;
+}
+
+/**
+ * Get the next pending work
+ * @return The work function or NULL when there is no work pending
+ */
+static work_func work_next(void) {
+	work_func func = NULL;
+	uint32_t mask = cm_mask_interrupts(1);
+	int i;
+
+	for (i = 0; i < WORK_PRIO_NB; i++) {
+		struct WorkQueue *queue = &work_queues[i];
+		if (queue->count == 0)
+			continue;
+
+		func = queue->funcs[queue->extract_idx];
+		queue->extract_idx = (queue->extract_idx + 1) % WORK_QUEUE_SIZE;
+		queue->count--;
+		break;
+	}
+
+	cm_mask_interrupts(mask);
+	return func;
+}
+
+/**
+ * The PendSV handler which runs all the pending work
+ */
+void pend_sv_handler(void) {
+	work_func func;
+
+	while ((func = work_next()) != NULL) {
+		PROF_ENTER(PROF_WORK);
+		func();
+		PROF_EXIT(PROF_WORK);
+	}
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MODULES_WORK_H_
+#define MODULES_WORK_H_
+
+#include <libopencm3/cm3/common.h>
+
+#define WORK_QUEUE_SIZE			8			/**< The maximum pending work per priority */
+
+/**
+ * The work priorities, high priority work always runs first
+ */
+enum work_priority {
+	WORK_PRIO_HIGH			= 0,			/**< Work that needs to be done before the next radio event */
+	WORK_PRIO_LOW,							/**< Work that can wait (output, statistics) */
+	WORK_PRIO_NB							/**< The amount of priorities */
+};
+
+/* External functions */
+typedef void (*work_func) (void);
+extern uint32_t work_dropped;
+extern uint8_t work_max_pending;
+void work_init(void);
+bool work_post(work_func func, enum work_priority prio);
+
+#endif /* MODULES_WORK_H_ */
@@ -22,8 +22,12 @@
 #include "../modules/button.h"
 #include "../modules/timer.h"
 #include "../modules/cyrf6936.h"
+#include "../modules/capture.h"
+#include "../modules/linkstats.h"
+#include "../modules/work.h"
 
 #include "dsm_mitm.h"
+#include <libopencm3/cm3/cortex.h>
 
 struct DsmMitm dsm_mitm;
 
@@ -33,12 +37,14 @@ void dsm_mitm_timer_cb(void);
 void dsm_mitm_receive_cb(bool error);
 void dsm_mitm_send_cb(bool error);
 void dsm_mitm_cdcacm_cb(char *data, int size);
+void dsm_mitm_frame_work(void);
 
 void dsm_mitm_set_rf_channel(uint8_t chan);
 void dsm_mitm_set_channel(uint8_t chan);
 void dsm_mitm_set_next_channel(void);
 
 void dsm_mitm_create_packet(uint8_t data[], uint8_t length);
+static void dsm_mitm_tunnel_output(uint8_t *data, uint8_t length);
 
 void Delay2(uint32_t x);
 void Delay2(uint32_t x)
@@ -105,6 +111,9 @@ void dsm_mitm_stop(void) {
 	// Stop the timer
 	timer_dsm_stop();
 	dsm_mitm.status = DSM_MITM_STOP;
+
+	// Idle the radio and remove the callbacks
+	protocol_stop_common();
 }
 
 
@@ -167,6 +176,8 @@ void dsm_mitm_start_transfer(void) {
 
 	dsm_mitm.status = DSM_MITM_SYNC_A;
 	dsm_mitm.rf_channel_idx = 0;
+	linkstats_reset();
+	tunnel_init(&dsm_mitm.tunnel, dsm_mitm_tunnel_output);
 	dsm_mitm.missed_packets = 0;
 	dsm_mitm.tx_packet_count = 0;
 	dsm_mitm.rx_packet_count = 0;
@@ -192,6 +203,8 @@ void dsm_mitm_start_transfer(void) {
 	dsm_mitm.num_channels = usbrf_config.dsm_num_channels;
 	dsm_mitm.protocol = usbrf_config.dsm_protocol;
 	dsm_mitm.resolution = (dsm_mitm.protocol & 0x10)>>4;
+	convert_frame_init(&dsm_mitm.frame, dsm_mitm.num_channels, usbrf_config.dsm_failsafe_us);
+	dsm_mitm.rx_packet_new = false;
 
 	// Calculate the CRC seed, SOP column and Data column
 	dsm_mitm.crc_seed = ~((dsm_mitm.mfg_id[0] << 8) + dsm_mitm.mfg_id[1]);
@@ -261,6 +274,8 @@ void dsm_mitm_timer_cb(void) {
 		// Check if we missed too much packets
 		DEBUG(protocol, "Lost a packet at channel 0x%02X", dsm_mitm.rf_channel);
 		dsm_mitm.missed_packets++;
+		linkstats_timeout(dsm_mitm.rf_channel_idx);
+		convert_frame_missed(&dsm_mitm.frame, dsm_mitm.missed_packets, usbrf_config.dsm_max_missed_packets, usbrf_config.dsm_failsafe_us);
 
 		// Set RX led off
 #ifdef LED_RX
@@ -274,7 +289,7 @@ void dsm_mitm_timer_cb(void) {
 			cyrf_start_recv();
 
 			// Start the timer
-			timer_dsm_set(DSM_RECV_TIME);
+			timer_dsm_set(DSM_RECV_TIMEOUT(dsm_mitm.protocol));
 		} else {
 			DEBUG(protocol, "Lost sync after 0x%02X missed packets", dsm_mitm.missed_packets);
 			// We are out of sync and start syncing again
@@ -293,19 +308,26 @@ void dsm_mitm_timer_cb(void) {
  * DSM MITM receive callback
  */
 void dsm_mitm_receive_cb(bool error) {
-	uint8_t packet_length, packet[16], rx_status;
+	uint8_t packet_length, packet[16], rx_status, rssi;
 	uint16_t bind_sum;
 	int i;
 
 	// Get the receive count, rx_status and the packet
 	packet_length = cyrf_read_register(CYRF_RX_COUNT);
+	if(packet_length > sizeof(packet))
+		packet_length = sizeof(packet);
 	rx_status = cyrf_get_rx_status();
+	rssi = cyrf_get_rssi();
 	cyrf_recv_len(packet, packet_length);
 
 	// Abort the receive
 	cyrf_write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_RX | CYRF_FRC_END);
 	cyrf_write_register(CYRF_RX_ABORT, 0x00); //TODO: CYRF_RX_ABORT_EN
 
+	// Capture the packet
+	capture_packet(dsm_mitm.rf_channel, dsm_mitm.sop_col, dsm_mitm.crc_seed != ((dsm_mitm.mfg_id[0] << 8) + dsm_mitm.mfg_id[1]),
+			packet, packet_length, rssi, rx_status, error);
+
 	// Check if length bigger then two
 	if(packet_length < 2)
 		return;
@@ -391,7 +413,7 @@ void dsm_mitm_receive_cb(bool error) {
 		cyrf_start_recv();
 
 		// Start the timer
-		timer_dsm_set(DSM_RECV_TIME);
+		timer_dsm_set(DSM_RECV_TIMEOUT(dsm_mitm.protocol));
 		break;
 	case DSM_MITM_SYNC_B:
 		// If other error than bad CRC or MFG id doesn't match reject the packet
@@ -424,7 +446,7 @@ void dsm_mitm_receive_cb(bool error) {
 			cyrf_start_recv();
 
 			// Start the timer
-			timer_dsm_set(DSM_RECV_TIME);
+			timer_dsm_set(DSM_RECV_TIMEOUT(dsm_mitm.protocol));
 		}
 		break;
 	case DSM_MITM_RECV:
@@ -433,6 +455,7 @@ void dsm_mitm_receive_cb(bool error) {
 			break;
 		if(!CHECK_MFG_ID_BOTH(dsm_mitm.protocol, packet, dsm_mitm.mfg_id))
 			break;
+		linkstats_receive(dsm_mitm.rf_channel_idx, dsm_mitm.rf_channel, rssi, rx_status, timer_dsm_get_time());
 
 		// Invert the CRC when received bad CRC
 		if (error && (rx_status & CYRF_BAD_CRC))
@@ -453,15 +476,15 @@ void dsm_mitm_receive_cb(bool error) {
 			DEBUG(protocol, "Receive data channel[0x%02X]: 0x%02X (timing %s: %u)", dsm_mitm.rf_channel_idx, dsm_mitm.rf_channel,
 								dsm_mitm.crc_seed == ((dsm_mitm.mfg_id[0] << 8) + dsm_mitm.mfg_id[1])? "short":"long", timer_dsm_get_time());
 
+			// Handle the acknowledgements and output the data received
+			tunnel_receive(&dsm_mitm.tunnel, &packet[2], packet_length-2);
+
 			// Check if we need to send a packet
 			if(usbrf_config.dsm_mitm_has_uplink) {
-				// Only create packet without packet loss
-				//if(packet[1] == ((dsm_mitm.mfg_id[3]+1+dsm_mitm.packet_loss_bit)&0xFF) || packet[1] == ((~dsm_mitm.mfg_id[3]+1+dsm_mitm.packet_loss_bit)&0xFF)) {
-					dsm_mitm.packet_loss_bit = !dsm_mitm.packet_loss_bit;
-					uint8_t tx_data[14];
-					uint8_t tx_size = convert_extract(&dsm_mitm.tx_buffer, tx_data, 14);
-					dsm_mitm_create_packet(tx_data, tx_size);
-				//}
+				// Answer with the next tunnel frame and the acknowledgements
+				uint8_t tx_data[TUNNEL_HEADER + TUNNEL_MAX_DATA];
+				uint8_t tx_size = tunnel_create(&dsm_mitm.tunnel, &dsm_mitm.tx_buffer, tx_data, true);
+				dsm_mitm_create_packet(tx_data, tx_size);
 
 				// Send the packet with a timeout, need to fix the sleep
 				Delay2(200);
@@ -475,15 +498,13 @@ void dsm_mitm_receive_cb(bool error) {
 				if(dsm_mitm.crc_seed == ((dsm_mitm.mfg_id[0] << 8) + dsm_mitm.mfg_id[1]))
 					timer_dsm_set(DSM_RECV_TIME_SHORT);
 				else
-					timer_dsm_set(DSM_RECV_TIME);
+					timer_dsm_set(DSM_RECV_TIMEOUT(dsm_mitm.protocol));
 			}
-
-			// Output the data received
-			cdcacm_send((char*)&packet[2], packet_length-2);
 		} else {
-			// Convert the channels
-			static int16_t channels[14];
-			convert_radio_to_channels(&packet[2], dsm_mitm.num_channels, dsm_mitm.resolution, channels);
+			// Convert the channels into the servo frame outside the interrupt
+			memcpy(dsm_mitm.rx_packet, packet, 16);
+			dsm_mitm.rx_packet_new = true;
+			work_post(dsm_mitm_frame_work, WORK_PRIO_LOW);
 
 			//DEBUG(protocol, "Receive commands channel[0x%02X]: 0x%02X (timing %s: %u)", dsm_mitm.rf_channel_idx, dsm_mitm.rf_channel,
 				//	dsm_mitm.crc_seed == ((dsm_mitm.mfg_id[0] << 8) + dsm_mitm.mfg_id[1])? "short":"long", timer_dsm_get_time());
@@ -496,7 +517,7 @@ void dsm_mitm_receive_cb(bool error) {
 				if(dsm_mitm.crc_seed == ((dsm_mitm.mfg_id[0] << 8) + dsm_mitm.mfg_id[1]))
 					timer_dsm_set(DSM_RECV_TIME_SHORT);
 				else
-					timer_dsm_set(DSM_RECV_TIME);
+					timer_dsm_set(DSM_RECV_TIMEOUT(dsm_mitm.protocol));
 			} else {
 				// Start the data timer
 				timer_dsm_set(DSM_RECV_TIME_DATA);
@@ -531,7 +552,14 @@ void dsm_mitm_send_cb(bool error) {
 	if(dsm_mitm.crc_seed == ((dsm_mitm.mfg_id[0] << 8) + dsm_mitm.mfg_id[1]))
 		timer_dsm_set(DSM_RECV_TIME_SHORT-timer_dsm_get_time());
 	else
-		timer_dsm_set(DSM_RECV_TIME-timer_dsm_get_time());
+		timer_dsm_set(DSM_RECV_TIMEOUT(dsm_mitm.protocol)-timer_dsm_get_time());
+}
+
+/**
+ * DSM MITM tunnel output, sends the data received in order to the host
+ */
+static void dsm_mitm_tunnel_output(uint8_t *data, uint8_t length) {
+	cdcacm_send((char*)data, length);
 }
 
 /**
@@ -541,6 +569,25 @@ void dsm_mitm_cdcacm_cb(char *data, int size) {
 	convert_insert(&dsm_mitm.tx_buffer, (uint8_t*)data, size);
 }
 
+/**
+ * DSM MITM frame work, decodes the received commands outside the interrupt
+ */
+void dsm_mitm_frame_work(void) {
+	uint8_t packet[16];
+	bool packet_new;
+	uint32_t mask;
+
+	// Take the received commands before the next packet arrives
+	mask = cm_mask_interrupts(1);
+	packet_new = dsm_mitm.rx_packet_new;
+	memcpy(packet, dsm_mitm.rx_packet, 16);
+	dsm_mitm.rx_packet_new = false;
+	cm_mask_interrupts(mask);
+
+	if(packet_new)
+		convert_radio_to_frame(&dsm_mitm.frame, &packet[2], dsm_mitm.resolution);
+}
+
 /**
  * Change DSM MITM RF channel
  * @param[in] chan The channel that need to be switched to
@@ -579,10 +626,10 @@ void dsm_mitm_create_packet(uint8_t data[], uint8_t length) {
 	int i;
 	if(IS_DSM2(dsm_mitm.protocol)) {
 		dsm_mitm.tx_packet[0] = ~dsm_mitm.mfg_id[2];
-		dsm_mitm.tx_packet[1] = (~dsm_mitm.mfg_id[3]+1+dsm_mitm.packet_loss_bit)&0xFF;
+		dsm_mitm.tx_packet[1] = (~dsm_mitm.mfg_id[3]+1)&0xFF;
 	} else {
 		dsm_mitm.tx_packet[0] = dsm_mitm.mfg_id[2];
-		dsm_mitm.tx_packet[1] = (dsm_mitm.mfg_id[3]+1+dsm_mitm.packet_loss_bit)&0xFF;
+		dsm_mitm.tx_packet[1] = (dsm_mitm.mfg_id[3]+1)&0xFF;
 	}
 
 	// Copy the commands
@@ -22,6 +22,7 @@
 
 #include "../helper/dsm.h"
 #include "../helper/convert.h"
+#include "../helper/tunnel.h"
 
 enum dsm_mitm_status {
 	DSM_MITM_STOP			= 0x0,			/**< The receiver is stopped */
@@ -51,16 +52,16 @@ struct DsmMitm {
 	uint8_t data_col;							/**< The DATA column number */
 	uint16_t crc_seed;							/**< The CRC seed */
 
-	uint8_t packet_loss_bit;					/**< Packet loss bit */
 	uint8_t missed_packets;						/**< Missed packets since last receive */
 	uint8_t num_channels;						/**< The number of channels the transmitter is sending commands over (not RF channels) */
+	struct ChannelFrame frame;					/**< The decoded servo channel frame */
+	bool rx_packet_new;							/**< When the received commands still need decoding */
 
 	struct Buffer tx_buffer;					/**< The transmit buffer */
+	struct Tunnel tunnel;						/**< The reliable data tunnel to the transmitter side */
 };
 
-#define CHECK_MFG_ID_DATA(protocol, packet, id) ((IS_DSM2(protocol) && packet[0] == (~id[2]&0xFF) && (packet[1] == ((~id[3]+1)&0xFF) || packet[1] == ((~id[3]+2)&0xFF))) || \
-		(IS_DSMX(protocol) && packet[0] == id[2] && (packet[1] == id[3]+1 || packet[1] == id[3]+2)))
-#define CHECK_MFG_ID_BOTH(protocol, packet, id) (CHECK_MFG_ID(protocol, packet, id) || CHECK_MFG_ID_DATA(protocol, packet, id))
+extern struct DsmMitm dsm_mitm;
 
 /* External functions */
 void dsm_mitm_init(void);
@@ -22,9 +22,15 @@
 #include "../modules/button.h"
 #include "../modules/timer.h"
 #include "../modules/cyrf6936.h"
+#include "../modules/capture.h"
+#include "../modules/linkstats.h"
+#include "../modules/work.h"
+#include "../modules/servo.h"
+#include "../modules/cdcacm.h"
 #include "../helper/convert.h"
 
 #include "dsm_receiver.h"
+#include <libopencm3/cm3/cortex.h>
 
 struct DsmReceiver dsm_receiver;
 
@@ -32,10 +38,12 @@ void dsm_receiver_start_bind(void);
 void dsm_receiver_start_transfer(void);
 void dsm_receiver_timer_cb(void);
 void dsm_receiver_receive_cb(bool error);
+void dsm_receiver_frame_work(void);
 
 void dsm_receiver_set_rf_channel(uint8_t chan);
 void dsm_receiver_set_channel(uint8_t chan);
 void dsm_receiver_set_next_channel(void);
+void dsm_receiver_set_codes(void);
 
 /**
  * DSM Receiver protocol initialization
@@ -85,6 +93,9 @@ void dsm_receiver_stop(void) {
 	// Stop the timer
 	timer_dsm_stop();
 	dsm_receiver.status = DSM_RECEIVER_STOP;
+
+	// Idle the radio and remove the callbacks
+	protocol_stop_common();
 }
 
 
@@ -143,6 +154,7 @@ void dsm_receiver_start_transfer(void) {
 
 	dsm_receiver.status = DSM_RECEIVER_SYNC_A;
 	dsm_receiver.rf_channel_idx = 0;
+	linkstats_reset();
 	dsm_receiver.missed_packets = 0;
 
 	// Set the bind led off
@@ -162,10 +174,15 @@ void dsm_receiver_start_transfer(void) {
 
 	// Set the CYRF configuration
 	cyrf_set_config_len(cyrf_transfer_config, dsm_transfer_config_size());
+	if(usbrf_config.dsm_soft_crc)
+		cyrf_set_rx_override(CYRF_DIS_RXCRC);
 
 	dsm_receiver.num_channels = usbrf_config.dsm_num_channels;
 	dsm_receiver.protocol = usbrf_config.dsm_protocol;
 	dsm_receiver.resolution = (dsm_receiver.protocol & 0x10)>>4;
+	convert_frame_init(&dsm_receiver.frame, dsm_receiver.num_channels, usbrf_config.dsm_failsafe_us);
+	dsm_receiver.rx_packet_new = false;
+	dsm_receiver.rx_missed = false;
 
 	// Calculate the CRC seed, SOP column and Data column
 	dsm_receiver.crc_seed = ~((dsm_receiver.mfg_id[0] << 8) + dsm_receiver.mfg_id[1]);
@@ -228,6 +245,9 @@ void dsm_receiver_timer_cb(void) {
 
 		cyrf_start_recv();
 
+		// Keep the servo outputs running with the failsafe values
+		work_post(dsm_receiver_frame_work, WORK_PRIO_LOW);
+
 		// Set the new timeout
 		timer_dsm_set(DSM_SYNC_RECV_TIME);
 		break;
@@ -235,6 +255,9 @@ void dsm_receiver_timer_cb(void) {
 		// Check if we missed too much packets
 		DEBUG(protocol, "Lost a packet at channel 0x%02X", dsm_receiver.rf_channel);
 		dsm_receiver.missed_packets++;
+		linkstats_timeout(dsm_receiver.rf_channel_idx);
+		dsm_receiver.rx_missed = true;
+		work_post(dsm_receiver_frame_work, WORK_PRIO_LOW);
 
 		// Set RX led off
 #ifdef LED_RX
@@ -248,7 +271,7 @@ void dsm_receiver_timer_cb(void) {
 			cyrf_start_recv();
 
 			// Start the timer
-			timer_dsm_set(DSM_RECV_TIME);
+			timer_dsm_set(DSM_RECV_TIMEOUT(dsm_receiver.protocol));
 		} else {
 			DEBUG(protocol, "Lost sync after 0x%02X missed packets", dsm_receiver.missed_packets);
 			// We are out of sync and start syncing again
@@ -267,19 +290,39 @@ void dsm_receiver_timer_cb(void) {
  * DSM Receiver receive callback
  */
 void dsm_receiver_receive_cb(bool error) {
-	uint8_t packet_length, packet[16], rx_status;
-	uint16_t bind_sum;
+	uint8_t packet_length, packet[16], rx_status, rssi;
+	uint16_t bind_sum, rx_crc = 0;
+	bool crc_ok = true;
 	int i;
 
 	// Get the receive count, rx_status and the packet
 	packet_length = cyrf_read_register(CYRF_RX_COUNT);
+	if(packet_length > sizeof(packet))
+		packet_length = sizeof(packet);
 	rx_status = cyrf_get_rx_status();
+	rssi = cyrf_get_rssi();
 	cyrf_recv_len(packet, packet_length);
+	if(usbrf_config.dsm_soft_crc)
+		rx_crc = (cyrf_read_register(CYRF_RX_CRC_MSB) << 8) | cyrf_read_register(CYRF_RX_CRC_LSB);
 
 	// Abort the receive
 	cyrf_write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_RX | CYRF_FRC_END);
 	cyrf_write_register(CYRF_RX_ABORT, 0x00); //TODO: CYRF_RX_ABORT_EN
 
+	// Check the CRC in software against both seeds, this also tells the A and B packets apart
+	if(usbrf_config.dsm_soft_crc && dsm_receiver.status != DSM_RECEIVER_BIND)
+		crc_ok = dsm_check_crc(packet, packet_length, rx_crc, (dsm_receiver.mfg_id[0] << 8) + dsm_receiver.mfg_id[1], &dsm_receiver.crc_seed);
+
+	// Capture the packet with the seed that matched
+	capture_packet(dsm_receiver.rf_channel, dsm_receiver.sop_col, dsm_receiver.crc_seed != ((dsm_receiver.mfg_id[0] << 8) + dsm_receiver.mfg_id[1]),
+			packet, packet_length, rssi, rx_status, error || !crc_ok);
+
+	if(!crc_ok) {
+		if(dsm_receiver.status == DSM_RECEIVER_RECV)
+			linkstats_crc_error(dsm_receiver.rf_channel_idx);
+		return;
+	}
+
 	// Check if length bigger then two
 	if(packet_length < 2)
 		return;
@@ -364,7 +407,7 @@ void dsm_receiver_receive_cb(bool error) {
 		cyrf_start_recv();
 
 		// Start the timer
-		timer_dsm_set(DSM_RECV_TIME);
+		timer_dsm_set(DSM_RECV_TIMEOUT(dsm_receiver.protocol));
 		break;
 	case DSM_RECEIVER_SYNC_B:
 		// If other error than bad CRC or MFG id doesn't match reject the packet
@@ -397,7 +440,7 @@ void dsm_receiver_receive_cb(bool error) {
 			cyrf_start_recv();
 
 			// Start the timer
-			timer_dsm_set(DSM_RECV_TIME);
+			timer_dsm_set(DSM_RECV_TIMEOUT(dsm_receiver.protocol));
 		}
 		break;
 	case DSM_RECEIVER_RECV:
@@ -406,6 +449,7 @@ void dsm_receiver_receive_cb(bool error) {
 			break;
 		if(!CHECK_MFG_ID(dsm_receiver.protocol, packet, dsm_receiver.mfg_id))
 			break;
+		linkstats_receive(dsm_receiver.rf_channel_idx, dsm_receiver.rf_channel, rssi, rx_status, timer_dsm_get_time());
 
 		// Invert the CRC when received bad CRC
 		if (error && (rx_status & CYRF_BAD_CRC))
@@ -420,9 +464,10 @@ void dsm_receiver_receive_cb(bool error) {
 		LED_ON(LED_RX);
 #endif
 
-		// Convert the channels
-		static int16_t channels[14];
-		convert_radio_to_channels(&packet[2], dsm_receiver.num_channels, dsm_receiver.resolution, channels);
+		// Convert the channels into the servo frame outside the interrupt
+		memcpy(dsm_receiver.rx_packet, &packet[2], 14);
+		dsm_receiver.rx_packet_new = true;
+		work_post(dsm_receiver_frame_work, WORK_PRIO_LOW);
 
 		DEBUG(protocol, "Receive commands channel[0x%02X]: 0x%02X (timing %s: %u)", dsm_receiver.rf_channel_idx, dsm_receiver.rf_channel,
 				dsm_receiver.crc_seed == ((dsm_receiver.mfg_id[0] << 8) + dsm_receiver.mfg_id[1])? "short":"long", timer_dsm_get_time());
@@ -435,13 +480,40 @@ void dsm_receiver_receive_cb(bool error) {
 		if(dsm_receiver.crc_seed == ((dsm_receiver.mfg_id[0] << 8) + dsm_receiver.mfg_id[1]))
 			timer_dsm_set(DSM_RECV_TIME_SHORT);
 		else
-			timer_dsm_set(DSM_RECV_TIME);
+			timer_dsm_set(DSM_RECV_TIMEOUT(dsm_receiver.protocol));
 		break;
 	default:
 		break;
 	}
 }
 
+/**
+ * DSM Receiver frame work, decodes the received commands and updates the outputs
+ * This runs from the work queue so the receive interrupt stays short
+ */
+void dsm_receiver_frame_work(void) {
+	uint8_t packet[14];
+	bool packet_new, missed;
+	uint32_t mask;
+
+	// Take the received commands before the next packet arrives
+	mask = cm_mask_interrupts(1);
+	packet_new = dsm_receiver.rx_packet_new;
+	missed = dsm_receiver.rx_missed;
+	memcpy(packet, dsm_receiver.rx_packet, 14);
+	dsm_receiver.rx_packet_new = false;
+	dsm_receiver.rx_missed = false;
+	cm_mask_interrupts(mask);
+
+	if(packet_new)
+		convert_radio_to_frame(&dsm_receiver.frame, packet, dsm_receiver.resolution);
+	if(missed)
+		convert_frame_missed(&dsm_receiver.frame, dsm_receiver.missed_packets, usbrf_config.dsm_max_missed_packets, usbrf_config.dsm_failsafe_us);
+
+	servo_output(&dsm_receiver.frame);
+	cdcacm_hid_update(&dsm_receiver.frame);
+}
+
 /**
  * Change DSM Receiver RF channel
  * @param[in] chan The channel that need to be switched to
@@ -458,8 +530,7 @@ void dsm_receiver_set_rf_channel(uint8_t chan) {
 void dsm_receiver_set_channel(uint8_t chan) {
 	dsm_receiver.crc_seed		= ~dsm_receiver.crc_seed;
 	dsm_receiver.rf_channel 	= chan;
-	dsm_set_channel(dsm_receiver.rf_channel, IS_DSM2(dsm_receiver.protocol),
-			dsm_receiver.sop_col, dsm_receiver.data_col, dsm_receiver.crc_seed);
+	dsm_receiver_set_codes();
 }
 
 /**
@@ -469,6 +540,17 @@ void dsm_receiver_set_next_channel(void) {
 	dsm_receiver.rf_channel_idx = IS_DSM2(dsm_receiver.protocol)? (dsm_receiver.rf_channel_idx+1) % 2 : (dsm_receiver.rf_channel_idx+1) % 23;
 	dsm_receiver.crc_seed		= ~dsm_receiver.crc_seed;
 	dsm_receiver.rf_channel 	= dsm_receiver.rf_channels[dsm_receiver.rf_channel_idx];
-	dsm_set_channel(dsm_receiver.rf_channel, IS_DSM2(dsm_receiver.protocol),
-			dsm_receiver.sop_col, dsm_receiver.data_col, dsm_receiver.crc_seed);
+	dsm_receiver_set_codes();
+}
+
+/**
+ * Write the RF channel, SOP and DATA code, and the CRC seed unless the CRC is checked in software
+ */
+void dsm_receiver_set_codes(void) {
+	if(usbrf_config.dsm_soft_crc)
+		dsm_set_channel_codes(dsm_receiver.rf_channel, IS_DSM2(dsm_receiver.protocol),
+				dsm_receiver.sop_col, dsm_receiver.data_col);
+	else
+		dsm_set_channel(dsm_receiver.rf_channel, IS_DSM2(dsm_receiver.protocol),
+				dsm_receiver.sop_col, dsm_receiver.data_col, dsm_receiver.crc_seed);
 }
@@ -21,6 +21,7 @@
 #define PROTOCOL_DSM_RECEIVER_H_
 
 #include "../helper/dsm.h"
+#include "../helper/convert.h"
 
 enum dsm_receiver_status {
 	DSM_RECEIVER_STOP			= 0x0,			/**< The receiver is stopped */
@@ -47,6 +48,10 @@ struct DsmReceiver {
 
 	uint8_t missed_packets;					/**< Missed packets since last receive */
 	uint8_t num_channels;						/**< The number of channels the transmitter is sending commands over (not RF channels) */
+	struct ChannelFrame frame;					/**< The decoded servo channel frame */
+	uint8_t rx_packet[14];						/**< The last received commands, decoded outside the interrupt */
+	bool rx_packet_new;							/**< When the received commands still need decoding */
+	bool rx_missed;								/**< When a missed packet still needs to be applied to the frame */
 };
 
 /* External functions */
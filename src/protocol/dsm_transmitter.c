@@ -18,11 +18,13 @@
  */
 
 #include <stdlib.h>
+#include <libopencm3/cm3/cortex.h>
 #include "../modules/config.h"
 #include "../modules/led.h"
 #include "../modules/button.h"
 #include "../modules/timer.h"
 #include "../modules/cyrf6936.h"
+#include "../modules/capture.h"
 #include "../helper/convert.h"
 
 #include "dsm_transmitter.h"
@@ -41,7 +43,12 @@ void dsm_transmitter_set_channel(uint8_t chan);
 void dsm_transmitter_set_next_channel(void);
 
 static void dsm_transmitter_create_bind_packet(void);
+static void dsm_transmitter_create_tunnel_packet(void);
+static void dsm_transmitter_create_frame(void);
+static void dsm_transmitter_slot_end(void);
+static void dsm_transmitter_tunnel_output(uint8_t *data, uint8_t length);
 void dsm_transmitter_create_command_packet(uint8_t commands[]);
+void dsm_transmitter_create_data_packet(uint8_t data[], uint8_t length);
 
 /**
  * DSM Transmitter protocol initialization
@@ -50,6 +57,8 @@ void dsm_transmitter_init(void) {
 	uint8_t mfg_id[6];
 	DEBUG(protocol, "DSM Transmitter initializing");
 	dsm_transmitter.status = DSM_TRANSMITTER_STOP;
+	dsm_transmitter.surveyed = false;
+	dsm_transmitter.channels_count = 0;
 
 	// Configure the CYRF
 	cyrf_set_config_len(cyrf_config, dsm_config_size());
@@ -79,6 +88,7 @@ void dsm_transmitter_init(void) {
 	cyrf_register_send_callback(dsm_transmitter_send_cb);
 	button_bind_register_callback(dsm_transmitter_start_bind);
 	cdcacm_register_receive_callback(dsm_transmitter_cdcacm_cb);
+	cdcacm_register_channels_callback(dsm_transmitter_set_channels);
 
 	DEBUG(protocol, "DSM Transmitter initialized 0x%02X 0x%02X 0x%02X 0x%02X", mfg_id[0], mfg_id[1], mfg_id[2], mfg_id[3]);
 }
@@ -89,6 +99,14 @@ void dsm_transmitter_init(void) {
 void dsm_transmitter_start(void) {
 	DEBUG(protocol, "DSM Transmitter starting");
 
+	// Find the quietest channels before we start sending
+	if(usbrf_config.dsm_survey) {
+		dsm_survey(usbrf_config.dsm_max_channel, dsm_transmitter.survey_noise);
+		dsm_select_channels_dsm2(dsm_transmitter.survey_noise, usbrf_config.dsm_max_channel, dsm_transmitter.survey_dsm2);
+		dsm_transmitter.survey_bind = dsm_select_bind_channel(dsm_transmitter.survey_noise, usbrf_config.dsm_max_channel);
+		dsm_transmitter.surveyed = true;
+	}
+
 	// Check if need to start with binding procedure
 	if(usbrf_config.dsm_start_bind)
 		dsm_transmitter_start_bind();
@@ -103,6 +121,9 @@ void dsm_transmitter_stop(void) {
 	// Stop the timer
 	timer_dsm_stop();
 	dsm_transmitter.status = DSM_TRANSMITTER_STOP;
+
+	// Idle the radio and remove the callbacks
+	protocol_stop_common();
 }
 
 
@@ -136,6 +157,7 @@ void dsm_transmitter_start_bind(void) {
 
 	// Set the CYRF configuration
 	cyrf_set_config_len(cyrf_bind_config, dsm_bind_config_size());
+	cyrf_set_power(usbrf_config.dsm_tx_power);
 
 	// Set the CYRF data code
 	memcpy(data_code, pn_codes[0][8], 8);
@@ -145,6 +167,8 @@ void dsm_transmitter_start_bind(void) {
 	// Set the initial bind channel
 	if(usbrf_config.dsm_bind_channel > 0)
 		dsm_transmitter_set_rf_channel(usbrf_config.dsm_bind_channel);
+	else if(dsm_transmitter.surveyed)
+		dsm_transmitter_set_rf_channel(dsm_transmitter.survey_bind);
 	else
 		dsm_transmitter_set_rf_channel(rand() / (RAND_MAX / usbrf_config.dsm_max_channel + 1));
 
@@ -165,6 +189,15 @@ void dsm_transmitter_start_transfer(void) {
 	dsm_transmitter.status = DSM_TRANSMITTER_SENDA;
 	dsm_transmitter.rf_channel_idx = 0;
 	dsm_transmitter.tx_packet_count = 0;
+	dsm_transmitter.rx_packet_count = 0;
+	dsm_transmitter.tx_frame_count = 0;
+	memset(dsm_transmitter.hop_noise, 0, sizeof(dsm_transmitter.hop_noise));
+	dsm_transmitter.tx_data = false;
+	dsm_transmitter.rx_listen = false;
+	tunnel_init(&dsm_transmitter.tunnel, dsm_transmitter_tunnel_output);
+	dsm_transmitter.tx_latency_max = 0;
+	dsm_transmitter.tx_latency_sum = 0;
+	dsm_transmitter.tx_latency_count = 0;
 
 	// Set the bind led off
 #ifdef LED_BIND
@@ -181,8 +214,10 @@ void dsm_transmitter_start_transfer(void) {
 	LED_OFF(LED_TX);
 #endif
 
-	// Set the CYRF configuration
+	// Set the CYRF configuration and start at the configured power
 	cyrf_set_config_len(cyrf_transfer_config, dsm_transfer_config_size());
+	dsm_transmitter.tx_power = usbrf_config.dsm_tx_power;
+	dsm_transmitter.tx_power_good = 0;
 
 	dsm_transmitter.num_channels = usbrf_config.dsm_num_channels;
 	dsm_transmitter.protocol = usbrf_config.dsm_protocol;
@@ -203,8 +238,8 @@ void dsm_transmitter_start_transfer(void) {
 		dsm_transmitter.rf_channel_idx = 22;
 		dsm_transmitter_set_next_channel();
 	} else {
-		dsm_transmitter.rf_channels[0] = 0x15;
-		dsm_transmitter.rf_channels[1] = 0x3C;
+		dsm_transmitter.rf_channels[0] = dsm_transmitter.surveyed? dsm_transmitter.survey_dsm2[0] : 0x15;
+		dsm_transmitter.rf_channels[1] = dsm_transmitter.surveyed? dsm_transmitter.survey_dsm2[1] : 0x3C;
 		dsm_transmitter_set_next_channel();
 	}
 
@@ -241,6 +276,7 @@ void dsm_transmitter_timer_cb(void) {
 		// Start the timer as first so we make sure the timing is right
 		timer_dsm_stop();
 		timer_dsm_set(DSM_CHA_CHB_SEND_TIME);
+		dsm_transmitter_slot_end();
 
 		// Start transmitting mode
 		cyrf_start_transmit();
@@ -255,19 +291,19 @@ void dsm_transmitter_timer_cb(void) {
 		// Change the status
 		dsm_transmitter.status = DSM_TRANSMITTER_SENDB;
 
-		// Create and send the packet
-		//dsm_transmitter_create_data_packet(); TODO
-		if(convert_extract_size(&dsm_transmitter.tx_buffer) > 14) {
-			uint8_t tx_data[14];
-			convert_extract(&dsm_transmitter.tx_buffer, tx_data, 14);
-			dsm_transmitter_create_command_packet(tx_data);
-		}
+		// Create and send the packet, the commands when the host set channels
+		dsm_transmitter_create_frame();
+		if(dsm_transmitter.tx_commands_packets > 0)
+			dsm_transmitter_create_command_packet(dsm_transmitter.tx_commands[0]);
+		else
+			dsm_transmitter_create_tunnel_packet();
 		cyrf_send_len(dsm_transmitter.tx_packet, dsm_transmitter.tx_packet_length);
 		break;
 	case DSM_TRANSMITTER_SENDB:
 		// Start the timer as first so we make sure the timing is right
 		timer_dsm_stop();
-		timer_dsm_set(DSM_SEND_TIME - DSM_CHA_CHB_SEND_TIME);
+		timer_dsm_set(DSM_FRAME_TIME(dsm_transmitter.protocol) - DSM_CHA_CHB_SEND_TIME);
+		dsm_transmitter_slot_end();
 
 		// Start transmitting mode
 		cyrf_start_transmit();
@@ -282,7 +318,11 @@ void dsm_transmitter_timer_cb(void) {
 		// Change the status
 		dsm_transmitter.status = DSM_TRANSMITTER_SENDA;
 
-		// Send same packet again on other channel
+		// Create and send the next packet on the other channel, the commands again if they don't fit in one packet
+		if(dsm_transmitter.tx_commands_packets > 1)
+			dsm_transmitter_create_command_packet(dsm_transmitter.tx_commands[1]);
+		else
+			dsm_transmitter_create_tunnel_packet();
 		cyrf_send_len(dsm_transmitter.tx_packet, dsm_transmitter.tx_packet_length);
 		break;
 	default:
@@ -291,10 +331,46 @@ void dsm_transmitter_timer_cb(void) {
 }
 
 /**
- * DSM Transmitter receive callback
+ * DSM Transmitter receive callback, receives the telemetry after channel B
  */
 void dsm_transmitter_receive_cb(bool error) {
-	(void) error;
+	uint8_t packet_length, packet[16], rx_status, rssi;
+
+	// Get the receive count, rx_status and the packet
+	packet_length = cyrf_read_register(CYRF_RX_COUNT);
+	if(packet_length > sizeof(packet))
+		packet_length = sizeof(packet);
+	rx_status = cyrf_get_rx_status();
+	rssi = cyrf_get_rssi();
+	cyrf_recv_len(packet, packet_length);
+
+	// Abort the receive
+	cyrf_write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_RX | CYRF_FRC_END);
+	cyrf_write_register(CYRF_RX_ABORT, 0x00);
+
+	// Capture the packet
+	capture_packet(dsm_transmitter.rf_channel, dsm_transmitter.sop_col, dsm_transmitter.crc_seed != ((dsm_transmitter.mfg_id[0] << 8) + dsm_transmitter.mfg_id[1]),
+			packet, packet_length, rssi, rx_status, error);
+
+	// Only accept telemetry without errors in the slot
+	if(!dsm_transmitter.rx_listen || error || packet_length < 2)
+		return;
+	if(!CHECK_MFG_ID_DATA(dsm_transmitter.protocol, packet, dsm_transmitter.mfg_id))
+		return;
+
+	dsm_transmitter.rx_received = true;
+	dsm_transmitter.rx_packet_count++;
+
+	// Set RX led on
+#ifdef LED_RX
+	LED_ON(LED_RX);
+#endif
+
+	// Feed the power control with the signal strength of the telemetry
+	dsm_transmitter_power_feedback(true, rssi);
+
+	// Handle the acknowledgements and the data
+	tunnel_receive(&dsm_transmitter.tunnel, &packet[2], packet_length-2);
 }
 
 /**
@@ -308,13 +384,96 @@ void dsm_transmitter_send_cb(bool error) {
 #ifdef LED_TX
 	LED_ON(LED_TX);
 #endif
+
+	// Listen for telemetry on this channel until the next packet is due, only data packets get an answer
+	if(dsm_transmitter.tx_data && (dsm_transmitter.status == DSM_TRANSMITTER_SENDA || dsm_transmitter.status == DSM_TRANSMITTER_SENDB)) {
+		dsm_transmitter.rx_listen = true;
+		cyrf_start_recv();
+	}
+}
+
+/**
+ * DSM Transmitter end of the telemetry slot
+ */
+static void dsm_transmitter_slot_end(void) {
+	uint16_t *noise = &dsm_transmitter.hop_noise[dsm_transmitter.rf_channel_idx];
+
+	// An empty slot measures the noise on this hop and lowers the link quality
+	if(dsm_transmitter.rx_listen && !dsm_transmitter.rx_received) {
+		*noise += (int16_t)(((cyrf_read_register(CYRF_RSSI) & 0x1F) << 4) - *noise) >> 3;
+		dsm_transmitter_power_feedback(false, 0);
+	}
+
+	dsm_transmitter.rx_listen = false;
+	dsm_transmitter.rx_received = false;
+}
+
+/**
+ * DSM Transmitter tunnel output, forwards the received data framed when capturing, otherwise as plain serial data
+ */
+static void dsm_transmitter_tunnel_output(uint8_t *data, uint8_t length) {
+	if(usbrf_config.capture_enable)
+		capture_telemetry(data, length);
+	else
+		cdcacm_send((char*)data, length);
+}
+
+/**
+ * DSM Transmitter power control, called for every telemetry slot
+ * Steps the power up at once when the link gets weak and down slowly while it stays good
+ * @param[in] received Whether a telemetry packet was received in the slot
+ * @param[in] rssi The RSSI of the telemetry packet
+ */
+void dsm_transmitter_power_feedback(bool received, uint8_t rssi) {
+	if(!usbrf_config.dsm_tx_power_auto)
+		return;
+
+	if(!received || rssi < usbrf_config.dsm_tx_power_rssi) {
+		// Step up immediately, but never above the configured power
+		dsm_transmitter.tx_power_good = 0;
+		if(dsm_transmitter.tx_power < usbrf_config.dsm_tx_power)
+			dsm_transmitter.tx_power++;
+	} else if(rssi >= usbrf_config.dsm_tx_power_rssi + DSM_TX_POWER_HYSTERESIS) {
+		// Step down after enough good packets
+		if(++dsm_transmitter.tx_power_good >= DSM_TX_POWER_STEP_DOWN) {
+			dsm_transmitter.tx_power_good = 0;
+			if(dsm_transmitter.tx_power > CYRF_PA_M35)
+				dsm_transmitter.tx_power--;
+		}
+	} else
+		dsm_transmitter.tx_power_good = 0;
+}
+
+/**
+ * DSM Transmitter set the channels, the latest values are send in the next frame
+ * @param[in] channels The normalized channel values (-CONVERT_NORM_MAX to CONVERT_NORM_MAX)
+ * @param[in] count The amount of channels (maximum CONVERT_MAX_CHANNELS)
+ */
+void dsm_transmitter_set_channels(int16_t *channels, uint8_t count) {
+	uint32_t mask;
+
+	if(count > CONVERT_MAX_CHANNELS)
+		count = CONVERT_MAX_CHANNELS;
+
+	// Overwrite the mailbox, older values which weren't send yet are dropped
+	mask = cm_mask_interrupts(1);
+	memcpy(dsm_transmitter.channels, channels, count * sizeof(int16_t));
+	dsm_transmitter.channels_count = count;
+	cm_mask_interrupts(mask);
 }
 
 /**
  * DSM Transmitter CDCACM receive callback
  */
 void dsm_transmitter_cdcacm_cb(char *data, int size) {
+	uint32_t mask = cm_mask_interrupts(1);
+
+	// Remember when the oldest waiting data arrived for the send deadline
+	if(convert_extract_size(&dsm_transmitter.tx_buffer) == 0)
+		dsm_transmitter.tx_wait_since = timer_get_time();
 	convert_insert(&dsm_transmitter.tx_buffer, (uint8_t*)data, size);
+
+	cm_mask_interrupts(mask);
 }
 
 
@@ -347,6 +506,9 @@ void dsm_transmitter_set_next_channel(void) {
 	dsm_transmitter.rf_channel 		= dsm_transmitter.rf_channels[dsm_transmitter.rf_channel_idx];
 	dsm_set_channel(dsm_transmitter.rf_channel, IS_DSM2(dsm_transmitter.protocol),
 			dsm_transmitter.sop_col, dsm_transmitter.data_col, dsm_transmitter.crc_seed);
+
+	// Update the power every hop, the register shadow skips the write when it didn't change
+	cyrf_set_power(dsm_transmitter.tx_power);
 }
 
 /**
@@ -406,4 +568,83 @@ void dsm_transmitter_create_command_packet(uint8_t commands[]) {
 
 	// Set the length
 	dsm_transmitter.tx_packet_length = 16;
+	dsm_transmitter.tx_data = false;
+}
+
+/**
+ * Create DSM Transmitter data packet, the receiver side answers these with telemetry
+ * @param[in] data The data to send
+ * @param[in] length The length of the data (maximum 14)
+ */
+void dsm_transmitter_create_data_packet(uint8_t data[], uint8_t length) {
+	int i;
+	if(IS_DSM2(dsm_transmitter.protocol)) {
+		dsm_transmitter.tx_packet[0] = ~dsm_transmitter.mfg_id[2];
+		dsm_transmitter.tx_packet[1] = (~dsm_transmitter.mfg_id[3]+1)&0xFF;
+	} else {
+		dsm_transmitter.tx_packet[0] = dsm_transmitter.mfg_id[2];
+		dsm_transmitter.tx_packet[1] = (dsm_transmitter.mfg_id[3]+1)&0xFF;
+	}
+
+	// Copy the data
+	for(i = 0; i < length; i++)
+		dsm_transmitter.tx_packet[i+2] = data[i];
+
+	// Set the length and expect telemetry
+	dsm_transmitter.tx_packet_length = length+2;
+	dsm_transmitter.tx_data = true;
+}
+
+/**
+ * Create DSM Transmitter tunnel packet, a data packet with the next frame of the tunnel
+ * Host data is batched into full frames, a partial frame is only send when the oldest data reaches the deadline
+ */
+static void dsm_transmitter_create_tunnel_packet(void) {
+	uint8_t tx_data[TUNNEL_HEADER + TUNNEL_MAX_DATA];
+	uint32_t tx_frames = dsm_transmitter.tunnel.stats.tx_frames;
+	uint32_t now = timer_get_time();
+	uint32_t waited = now - dsm_transmitter.tx_wait_since;
+	bool flush = (waited >= (uint32_t)usbrf_config.dsm_tx_deadline * 100);
+	uint8_t tx_size = tunnel_create(&dsm_transmitter.tunnel, &dsm_transmitter.tx_buffer, tx_data, flush);
+	dsm_transmitter_create_data_packet(tx_data, tx_size);
+
+	// Measure the latency of new data, the remaining data is counted from now
+	if(dsm_transmitter.tunnel.stats.tx_frames != tx_frames) {
+		if(waited > dsm_transmitter.tx_latency_max)
+			dsm_transmitter.tx_latency_max = waited;
+		dsm_transmitter.tx_latency_sum += waited;
+		dsm_transmitter.tx_latency_count++;
+		dsm_transmitter.tx_wait_since = now;
+	}
+}
+
+/**
+ * Create DSM Transmitter frame, encodes the channels in the mailbox into the command bytes of the A and B packet
+ * With 22ms frames A has channels 0-6 and B channels 7-13. With 11ms frames both packets have the same
+ * channel group, which alternates every frame. When all channels fit in A the B packet is used for data.
+ */
+static void dsm_transmitter_create_frame(void) {
+	uint8_t count = dsm_transmitter.channels_count;
+	uint8_t group = dsm_transmitter.tx_frame_count++ & 0x1;
+	bool is_11bit = dsm_transmitter.resolution;
+
+	if(count == 0) {
+		dsm_transmitter.tx_commands_packets = 0;
+	} else if(count <= DSM_TX_PACKET_CHANNELS) {
+		convert_channels_to_radio(dsm_transmitter.channels, 0, count, is_11bit, dsm_transmitter.tx_commands[0]);
+		dsm_transmitter.tx_commands_packets = 1;
+	} else if(IS_11MS(dsm_transmitter.protocol)) {
+		if(group == 0)
+			convert_channels_to_radio(dsm_transmitter.channels, 0, DSM_TX_PACKET_CHANNELS, is_11bit, dsm_transmitter.tx_commands[0]);
+		else
+			convert_channels_to_radio(dsm_transmitter.channels, DSM_TX_PACKET_CHANNELS, count - DSM_TX_PACKET_CHANNELS,
+					is_11bit, dsm_transmitter.tx_commands[0]);
+		memcpy(dsm_transmitter.tx_commands[1], dsm_transmitter.tx_commands[0], 14);
+		dsm_transmitter.tx_commands_packets = 2;
+	} else {
+		convert_channels_to_radio(dsm_transmitter.channels, 0, DSM_TX_PACKET_CHANNELS, is_11bit, dsm_transmitter.tx_commands[0]);
+		convert_channels_to_radio(dsm_transmitter.channels, DSM_TX_PACKET_CHANNELS, count - DSM_TX_PACKET_CHANNELS,
+				is_11bit, dsm_transmitter.tx_commands[1]);
+		dsm_transmitter.tx_commands_packets = 2;
+	}
 }
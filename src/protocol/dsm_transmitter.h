@@ -22,6 +22,13 @@
 
 #include "../helper/dsm.h"
 #include "../helper/convert.h"
+#include "../helper/tunnel.h"
+
+#define DSM_TX_POWER_RSSI			10			/**< The default telemetry RSSI target of the power control */
+#define DSM_TX_POWER_HYSTERESIS		3			/**< The RSSI above the target before lowering the power */
+#define DSM_TX_POWER_STEP_DOWN		16			/**< The good telemetry packets before lowering the power one step */
+#define DSM_TX_DEADLINE				10			/**< The default maximum time in ms host data waits for a full packet */
+#define DSM_TX_PACKET_CHANNELS		7			/**< The amount of channels in one command packet */
 
 enum dsm_transmitter_status {
 	DSM_TRANSMITTER_STOP		= 0x0,			/**< The transmitter is stopped */
@@ -39,22 +46,49 @@ struct DsmTransmitter {
 	uint8_t tx_packet[16];						/**< The transmit packet */
 	uint8_t tx_packet_length;					/**< The transmit packet length */
 	uint32_t tx_packet_count;					/**< The amount of packets send */
+	bool tx_data;								/**< When the transmit packet is a data packet which expects telemetry */
+	bool rx_listen;								/**< When listening for telemetry after a data packet */
+	bool rx_received;							/**< When telemetry was received in the current slot */
+	uint32_t rx_packet_count;					/**< The amount of telemetry packets received */
 
 	uint8_t rf_channel;							/**< The current RF channel*/
 	uint8_t rf_channel_idx;						/**< The index of the current channel */
 	uint8_t rf_channels[23];					/**< The RF channels used for transmitting */
+	bool surveyed;								/**< When the noise survey was done */
+	uint8_t survey_noise[DSM_MAX_CHANNEL + 1];	/**< The RSSI of every channel at the survey */
+	uint8_t survey_dsm2[2];						/**< The quietest DSM2 channel pair from the survey */
+	uint8_t survey_bind;						/**< The quietest bind channel from the survey */
+	uint16_t hop_noise[23];						/**< The average RSSI in empty telemetry slots per hop (times 16) */
 
 	uint8_t sop_col;							/**< The SOP column number */
 	uint8_t data_col;							/**< The DATA column number */
 	uint16_t crc_seed;							/**< The CRC seed */
 	uint8_t num_channels;						/**< The number of channels the transmitter is sending commands over (not RF channels) */
 
+	uint8_t tx_power;							/**< The current transmit power (CYRF_PA_*) */
+	uint8_t tx_power_good;						/**< The good telemetry packets since the last power change */
+
+	int16_t channels[CONVERT_MAX_CHANNELS];		/**< The latest normalized channel values from the host (mailbox) */
+	uint8_t channels_count;						/**< The amount of channels in the mailbox, 0 when never set */
+	uint8_t tx_commands[2][14];					/**< The command bytes of the A and B packet of the current frame */
+	uint8_t tx_commands_packets;				/**< The command packets in the current frame (0, only A or A and B) */
+	uint32_t tx_frame_count;					/**< The amount of frames send, selects the channel group with 11ms frames */
+
 	struct Buffer tx_buffer;					/**< The transmit buffer */
+	struct Tunnel tunnel;						/**< The reliable data tunnel to the receiver side */
+	uint32_t tx_wait_since;						/**< The arrival time of the oldest waiting host data in 10 microseconds */
+	uint32_t tx_latency_max;					/**< The maximum host write to air latency in 10 microseconds */
+	uint32_t tx_latency_sum;					/**< The sum of the host write to air latencies in 10 microseconds */
+	uint32_t tx_latency_count;					/**< The amount of latency measurements */
 };
 
+extern struct DsmTransmitter dsm_transmitter;
+
 /* External functions */
 void dsm_transmitter_init(void);
 void dsm_transmitter_start(void);
 void dsm_transmitter_stop(void);
+void dsm_transmitter_power_feedback(bool received, uint8_t rssi);
+void dsm_transmitter_set_channels(int16_t *channels, uint8_t count);
 
 #endif /* PROTOCOL_DSM_TRANSMITTER_H_ */
@@ -26,26 +26,28 @@
 #include "modules/timer.h"
 #include "modules/cdcacm.h"
 #include "modules/cyrf6936.h"
+#include "modules/servo.h"
+#include "modules/capture.h"
+#include "modules/linkstats.h"
+#include "modules/work.h"
+#include "modules/sched.h"
+#include "modules/console.h"
+#include "modules/ramfunc.h"
 
+static bool usbrf_protocol_started = false;
 
-int main(void) {
-	// Setup the clock
-	rcc_clock_setup_in_hse_12mhz_out_72mhz();
-
-	// Initialize the modules
-	config_init();
-	led_init();
-	timer_init();
-	cdcacm_init();
-
-	// Wait for receive
-	while(!cdcacm_did_receive && usbrf_config.debug_enable) {
-		cdcacm_run();
-	}
+/**
+ * Start the protocol as soon as the radio is out of reset, when debugging wait until the host is listening
+ */
+static void usbrf_protocol_task(void) {
+	if(!cyrf_is_ready())
+		return;
+	if(!cdcacm_did_receive && usbrf_config.debug_enable)
+		return;
 
 	// Initialize other modules
 	button_init();
-	cyrf_init();
+	cyrf_setup();
 
 	// Initialize the protocol
 	protocol_functions[usbrf_config.protocol][PROTOCOL_INIT]();
@@ -54,11 +56,59 @@ int main(void) {
 	if(usbrf_config.protocol_start)
 		protocol_functions[usbrf_config.protocol][PROTOCOL_START]();
 
-	/* The main loop */
-	while (1) {
-		// Run the cdcacm TODO: fix polling
-		cdcacm_run();
+	usbrf_protocol_started = true;
+	boot_timeline.protocol_start = timer_get_time();
+	sched_set_period(SCHED_TASK_PROTOCOL, 0);
+}
+
+/**
+ * Blink the bind led while waiting for the host
+ */
+static void usbrf_led_task(void) {
+	if(usbrf_protocol_started) {
+		sched_set_period(SCHED_TASK_LED, 0);
+		return;
 	}
 
+#ifdef LED_BIND
+	LED_TOGGLE(LED_BIND);
+#endif
+}
+
+/**
+ * The scheduler tasks
+ */
+struct SchedTask sched_tasks[SCHED_TASK_NB] = {
+	[SCHED_TASK_USB]		= {.name = "usb",		.func = cdcacm_run,				.period = 0},
+	[SCHED_TASK_PROTOCOL]	= {.name = "protocol",	.func = usbrf_protocol_task,	.period = 1},
+	[SCHED_TASK_CONFIG]		= {.name = "config",	.func = config_run,				.period = 0},
+	[SCHED_TASK_CAPTURE]	= {.name = "capture",	.func = capture_run,			.period = 100},
+	[SCHED_TASK_LINKSTATS]	= {.name = "linkstats",	.func = linkstats_run,			.period = LINKSTATS_INTERVAL},
+	[SCHED_TASK_LED]		= {.name = "led",		.func = usbrf_led_task,			.period = 250},
+	[SCHED_TASK_STATS]		= {.name = "stats",		.func = sched_report,			.period = SCHED_REPORT_INTERVAL},
+};
+
+
+int main(void) {
+	// Setup the clock
+	rcc_clock_setup_in_hse_12mhz_out_72mhz();
+	ramfunc_init();
+
+	// Initialize the modules
+	config_init();
+	work_init();
+	led_init();
+	timer_init();
+	servo_init();
+
+	// Start the radio reset, it comes up while USB enumerates
+	cyrf_init();
+	cdcacm_init();
+	console_init();
+
+	// Run the tasks
+	sched_init();
+	sched_run();
+
 	return 0;
 }
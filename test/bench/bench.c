@@ -0,0 +1,235 @@
+/*
+ * This file is part of the superbitrf project.
+ *
+ * Copyright (C) 2013 Freek van Tienen <freek.v.tienen@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "../../src/modules/config.h"
+#include "../../src/modules/led.h"
+#include "../../src/modules/timer.h"
+#include "../../src/modules/cdcacm.h"
+#include "../../src/modules/cyrf6936.h"
+#include "../../src/modules/sched.h"
+#include "../../src/modules/ramfunc.h"
+#include "../../src/helper/convert.h"
+#include "../../src/helper/dsm.h"
+#include "../../src/helper/crc.h"
+
+#define BENCH_ITERATIONS	256				/**< The iterations of every timed function */
+#define BENCH_SEND_BYTES	16384			/**< The bytes send through the CDCACM for the throughput */
+
+/* The config without the protocols from config.c, the bench always probes the SPI divider */
+struct Config usbrf_config = {
+	.timer_scaler = 1,
+	.cyrf_spi_div = 0,
+	.debug_enable = false,
+};
+char debug_msg[512];
+struct BootTimeline boot_timeline;
+
+/* The state used by the timed functions */
+static uint8_t bench_block[16];
+static uint8_t bench_channels[23];
+static uint8_t bench_mfg_id[4] = {0xDC, 0x72, 0x96, 0x4F};
+static uint8_t bench_idx = 0;
+static struct Buffer bench_buffer;
+static uint8_t bench_data[64];
+
+/**
+ * Send a line of the report, runs the USB until there is space in the transmit ring
+ */
+static void bench_printf(const char *fmt, ...) {
+	char line[80];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	while (!cdcacm_send(line, len))
+		cdcacm_run();
+}
+
+/**
+ * Time a function and report the minimum, average and maximum cycles
+ * @param[in] name The name in the report
+ * @param[in] func The function that is timed
+ */
+static void bench_run(const char *name, void (*func)(void)) {
+	uint32_t start, cycles, min = 0xFFFFFFFF, max = 0, sum = 0;
+	uint16_t i;
+
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		start = timer_get_cycles();
+		func();
+		cycles = timer_get_cycles() - start;
+
+		sum += cycles;
+		if (cycles < min)
+			min = cycles;
+		if (cycles > max)
+			max = cycles;
+	}
+
+	bench_printf("bench,%s,%u,%lu,%lu,%lu\r\n", name, BENCH_ITERATIONS, (unsigned long)min,
+			(unsigned long)(sum / BENCH_ITERATIONS), (unsigned long)max);
+}
+
+/* The timed functions */
+static void bench_empty(void) {
+}
+
+static void bench_spi_write(void) {
+	cyrf_write_register(CYRF_CRC_SEED_LSB, bench_idx++);
+}
+
+static void bench_spi_read(void) {
+	bench_idx += cyrf_read_register(CYRF_CRC_SEED_LSB);
+}
+
+static void bench_spi_write_block(void) {
+	cyrf_write_block(CYRF_DATA_CODE, bench_block, 16);
+}
+
+static void bench_spi_read_block(void) {
+	cyrf_read_block(CYRF_DATA_CODE, bench_block, 16);
+}
+
+static void bench_dsm_hop(void) {
+	bench_idx = (bench_idx + 1) % 23;
+	dsm_set_channel(bench_channels[bench_idx], false, bench_mfg_id[0] & 0x07, bench_mfg_id[0] & 0x07, 0x1234);
+}
+
+static void bench_dsm_generate(void) {
+	bench_mfg_id[3]++;
+	dsm_generate_channels_dsmx(bench_mfg_id, bench_channels);
+}
+
+static void bench_ring(void) {
+	convert_insert(&bench_buffer, bench_data, 64);
+	convert_extract(&bench_buffer, bench_data, 64);
+}
+
+static void bench_cdcacm_send(void) {
+	while (!cdcacm_send((char *)bench_data, 64))
+		cdcacm_run();
+}
+
+/**
+ * Measure the throughput of the CDCACM, including the USB transfers to the host
+ */
+static void bench_cdcacm_rate(void) {
+	uint32_t start, cycles, packets = cdcacm_tx_packets;
+	uint16_t sent;
+
+	start = timer_get_cycles();
+	for (sent = 0; sent < BENCH_SEND_BYTES; sent += 64)
+		bench_cdcacm_send();
+	cycles = timer_get_cycles() - start;
+
+	bench_printf("rate,cdcacm_send,%u,%lu,%lu\r\n", BENCH_SEND_BYTES, (unsigned long)cycles,
+			(unsigned long)((uint64_t)BENCH_SEND_BYTES * 72000000 / cycles));
+	bench_printf("rate,cdcacm_packets,%lu,%lu,0\r\n", (unsigned long)(cdcacm_tx_packets - packets), (unsigned long)cycles);
+}
+
+/**
+ * Check the CRC helpers against known vectors
+ * The DSM vectors were computed with a bitwise CRC-16 CCITT over the length byte and the payload,
+ * they check the software CRC and not what the CYRF6936 sends on air.
+ */
+static void bench_check_crc(void) {
+	static const uint8_t check[9] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+	static const uint8_t packet[16] = {0xDC, 0x72, 0x00, 0xAA, 0x05, 0xFF, 0x09, 0x55,
+			0x0D, 0x00, 0x11, 0x55, 0x15, 0x00, 0x19, 0x55};
+	uint16_t seed = 0xDC72, seed_a = 0x238D, crc_seed = 0;
+	bool ok;
+
+	bench_printf("check,crc16_ccitt,%s\r\n", (crc16_ccitt(0xFFFF, check, 9) == 0x29B1)? "ok" : "fail");
+
+	ok = dsm_check_crc(packet, 16, 0xBCE6, seed, &crc_seed) && crc_seed == seed;
+	bench_printf("check,dsm_check_crc_b,%s\r\n", ok? "ok" : "fail");
+	ok = dsm_check_crc(packet, 16, 0x7B0A, seed, &crc_seed) && crc_seed == seed_a;
+	bench_printf("check,dsm_check_crc_a,%s\r\n", ok? "ok" : "fail");
+	ok = !dsm_check_crc(packet, 15, 0xBCE6, seed, &crc_seed);
+	bench_printf("check,dsm_check_crc_bad,%s\r\n", ok? "ok" : "fail");
+}
+
+/**
+ * Run the benchmark once the radio is ready and the host is listening
+ */
+static void bench_task(void) {
+	if (!cyrf_is_ready() || !cdcacm_did_receive)
+		return;
+	sched_set_period(SCHED_TASK_PROTOCOL, 0);
+
+	// Select the SPI clock and reset the radio to the DSM config
+	cyrf_setup();
+	cyrf_reset();
+	cyrf_set_config_len(cyrf_config, dsm_config_size());
+	cyrf_set_config_len(cyrf_transfer_config, dsm_transfer_config_size());
+	dsm_generate_channels_dsmx(bench_mfg_id, bench_channels);
+	convert_init(&bench_buffer);
+	memset(bench_data, 'b', sizeof(bench_data));
+
+	bench_printf("spi_div,%u\r\n", cyrf_spi_info.div);
+	bench_check_crc();
+	bench_run("empty", bench_empty);
+	bench_run("spi_write", bench_spi_write);
+	bench_run("spi_read", bench_spi_read);
+	bench_run("spi_write_block16", bench_spi_write_block);
+	bench_run("spi_read_block16", bench_spi_read_block);
+	bench_run("dsm_set_channel", bench_dsm_hop);
+	bench_run("dsm_generate_channels_dsmx", bench_dsm_generate);
+	bench_run("ring_64", bench_ring);
+	bench_cdcacm_rate();
+	bench_printf("done\r\n");
+#ifdef LED_BIND
+	LED_ON(LED_BIND);
+#endif
+}
+
+/**
+ * The scheduler tasks, the benchmark runs in the protocol slot
+ */
+struct SchedTask sched_tasks[SCHED_TASK_NB] = {
+	[SCHED_TASK_USB]		= {.name = "usb",		.func = cdcacm_run,		.period = 0},
+	[SCHED_TASK_PROTOCOL]	= {.name = "bench",		.func = bench_task,		.period = 10},
+};
+
+int main(void) {
+	// Setup the clock
+	rcc_clock_setup_in_hse_12mhz_out_72mhz();
+	ramfunc_init();
+
+	// Initialize the modules
+	led_init();
+	timer_init();
+	cyrf_init();
+	cdcacm_init();
+
+	// Run the benchmark
+	sched_init();
+	sched_run();
+
+	return 0;
+}